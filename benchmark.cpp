@@ -0,0 +1,174 @@
+// throughput and latency of the thread pool, one json object per line on stdout
+//
+//     g++ -std=c++11 -O2 -pthread -I. benchmark.cpp -o benchmark                          (ctpl.h, boost lockfree queue)
+//     g++ -std=c++11 -O2 -pthread -I. -D_ctplBenchmarkStl_ benchmark.cpp -o benchmark_stl  (ctpl_stl.h, mutex queue)
+//     g++ -std=c++11 -O2 -pthread -I. -D_ctplBenchmarkStl_ -D_ctplThreadPoolRing_=1024 benchmark.cpp -o benchmark_ring  (ctpl_stl.h, lock-free ring)
+//
+//     benchmark [max threads] [tasks]
+//
+// the pools of 1, 2, 4, ... up to max threads are measured, with both schedules
+
+#ifdef _ctplBenchmarkStl_
+#include <ctpl_stl.h>
+#if _ctplThreadPoolRing_
+static const char * const backend = "ctpl_stl.h ring";
+#else
+static const char * const backend = "ctpl_stl.h";
+#endif
+#else
+#include <ctpl.h>
+static const char * const backend = "ctpl.h";
+#endif
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void wait_for(const std::atomic<long> & left) {
+    while (left.load(std::memory_order_acquire) > 0)
+        std::this_thread::yield();
+}
+
+static const char * name(ctpl::schedule mode) {
+    return mode == ctpl::schedule::fifo ? "fifo" : "work_stealing";
+}
+
+static void report(const std::string & bench, ctpl::schedule mode, int nThreads, long nTasks, double seconds, const std::string & extra = "") {
+    std::cout << "{\"backend\":\"" << backend << "\",\"schedule\":\"" << name(mode) << "\",\"bench\":\"" << bench
+              << "\",\"threads\":" << nThreads << ",\"tasks\":" << nTasks << ",\"seconds\":" << seconds
+              << ",\"tasks_per_sec\":" << (seconds > 0 ? nTasks / seconds : 0) << extra << "}\n";
+}
+
+// one thread pushes empty functors and waits for all their futures
+static void empty_futures(ctpl::schedule mode, int nThreads, long nTasks) {
+    ctpl::thread_pool p(nThreads, mode);
+    std::vector<ctpl::future<void>> results;
+    results.reserve(nTasks);
+    auto start = Clock::now();
+    for (long k = 0; k < nTasks; ++k)
+        results.push_back(p.push([](int){}));
+    for (auto & f : results)
+        f.get();
+    report("empty_futures", mode, nThreads, nTasks, seconds_since(start));
+}
+
+// one producer, all the threads of the pool consume
+static void fan_out(ctpl::schedule mode, int nThreads, long nTasks) {
+    ctpl::thread_pool p(nThreads, mode);
+    std::atomic<long> left(nTasks);
+    auto start = Clock::now();
+    for (long k = 0; k < nTasks; ++k)
+        p.post([&left](int){ left.fetch_sub(1, std::memory_order_release); });
+    wait_for(left);
+    report("fan_out", mode, nThreads, nTasks, seconds_since(start));
+}
+
+// as many producers as there are threads in the pool, pushing at the same time
+static void fan_in(ctpl::schedule mode, int nThreads, long nTasks) {
+    ctpl::thread_pool p(nThreads, mode);
+    long perProducer = nTasks / nThreads;
+    std::atomic<long> left(perProducer * nThreads);
+    std::vector<std::thread> producers;
+    auto start = Clock::now();
+    for (int i = 0; i < nThreads; ++i) {
+        producers.emplace_back([&p, &left, perProducer](){
+            for (long k = 0; k < perProducer; ++k)
+                p.post([&left](int){ left.fetch_sub(1, std::memory_order_release); });
+        });
+    }
+    for (auto & producer : producers)
+        producer.join();
+    wait_for(left);
+    report("fan_in", mode, nThreads, perProducer * nThreads, seconds_since(start));
+}
+
+// each functor pushes two more until the depth is reached, the pushes come from the threads of the pool
+struct Spawn {
+    ctpl::thread_pool * pool;
+    std::atomic<long> * left;
+    int depth;
+    void operator()(int) const {
+        if (this->depth > 0) {
+            Spawn child = { this->pool, this->left, this->depth - 1 };
+            this->pool->post(child);
+            this->pool->post(child);
+        }
+        this->left->fetch_sub(1, std::memory_order_release);
+    }
+};
+
+static void recursive_spawn(ctpl::schedule mode, int nThreads, long nTasks) {
+    ctpl::thread_pool p(nThreads, mode);
+    int depth = 0;
+    while ((2L << (depth + 1)) - 1 <= nTasks)
+        ++depth;
+    long total = (2L << depth) - 1;
+    std::atomic<long> left(total);
+    auto start = Clock::now();
+    Spawn root = { &p, &left, depth };
+    p.post(root);
+    wait_for(left);
+    report("recursive_spawn", mode, nThreads, total, seconds_since(start));
+}
+
+// the time from the push to the start of a functor, pushed one at a time to an idle pool
+static void push_to_start(ctpl::schedule mode, int nThreads, long nSamples) {
+    ctpl::thread_pool p(nThreads, mode);
+    std::vector<double> latencies;
+    latencies.reserve(nSamples);
+    auto begin = Clock::now();
+    for (long k = 0; k < nSamples; ++k) {
+        std::atomic<long> left(1);
+        Clock::time_point started;
+        auto pushed = Clock::now();
+        p.post([&left, &started](int){
+            started = Clock::now();
+            left.store(0, std::memory_order_release);
+        });
+        wait_for(left);
+        latencies.push_back(std::chrono::duration<double, std::nano>(started - pushed).count());
+        std::this_thread::sleep_for(std::chrono::microseconds(20));  // let the threads go idle again
+    }
+    double seconds = seconds_since(begin);
+    std::sort(latencies.begin(), latencies.end());
+    auto at = [&latencies](double q) { return latencies[static_cast<std::size_t>(q * (latencies.size() - 1))]; };
+    std::ostringstream extra;
+    extra << ",\"p50_ns\":" << at(0.5) << ",\"p90_ns\":" << at(0.9) << ",\"p99_ns\":" << at(0.99) << ",\"max_ns\":" << latencies.back();
+    report("push_to_start", mode, nThreads, nSamples, seconds, extra.str());
+}
+
+int main(int argc, char **argv) {
+    int maxThreads = argc > 1 ? std::atoi(argv[1]) : static_cast<int>(std::thread::hardware_concurrency());
+    long nTasks = argc > 2 ? std::atol(argv[2]) : 200000;
+    if (maxThreads < 1)
+        maxThreads = 1;
+    if (nTasks < 1)
+        nTasks = 1;
+
+    std::vector<int> threadCounts;
+    for (int n = 1; n < maxThreads; n *= 2)
+        threadCounts.push_back(n);
+    threadCounts.push_back(maxThreads);
+
+    for (ctpl::schedule mode : { ctpl::schedule::fifo, ctpl::schedule::work_stealing }) {
+        for (int nThreads : threadCounts) {
+            empty_futures(mode, nThreads, nTasks);
+            fan_out(mode, nThreads, nTasks);
+            fan_in(mode, nThreads, nTasks);
+            recursive_spawn(mode, nThreads, nTasks);
+            push_to_start(mode, nThreads, std::min(nTasks, 2000L));
+        }
+    }
+
+    return 0;
+}
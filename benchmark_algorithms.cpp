@@ -0,0 +1,165 @@
+// the parallel algorithms of ctpl_algorithms.h against the sequential ones of <algorithm> and <numeric>
+// and, when compiled as c++17 with a parallel standard library, against std::execution::par, one json object per line on stdout
+//
+//     g++ -std=c++17 -O2 -pthread -I. benchmark_algorithms.cpp -o benchmark_algorithms -ltbb                         (ctpl.h, with std::execution::par of libstdc++ on TBB)
+//     g++ -std=c++17 -O2 -pthread -I. -D_ctplBenchmarkStl_ benchmark_algorithms.cpp -o benchmark_algorithms_stl -ltbb  (ctpl_stl.h)
+//     g++ -std=c++11 -O2 -pthread -I. benchmark_algorithms.cpp -o benchmark_algorithms                                (without std::execution::par)
+//
+//     benchmark_algorithms [max threads] [elements]
+//
+// the pools of 1, 2, 4, ... up to max threads are measured, the calling thread takes part in the work besides them
+// std::execution::par runs on the threads of its own library, not limited by max threads, and is reported with 0 threads
+// every result is the best time of a few runs, the output of every run is checked against the sequential one
+
+#ifdef _ctplBenchmarkStl_
+#include <ctpl_stl.h>
+static const char * const backend = "ctpl_stl.h";
+#else
+#include <ctpl.h>
+static const char * const backend = "ctpl.h";
+#endif
+#include <ctpl_algorithms.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <cmath>
+#include <cstdlib>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<execution>)
+#include <execution>
+#if defined(__cpp_lib_execution) || defined(__cpp_lib_parallel_algorithm)
+#define _ctplBenchmarkPar_ 1
+#endif
+#endif
+#endif
+
+
+
+typedef std::chrono::steady_clock Clock;
+
+static const int nRuns = 3;
+
+static void report(const std::string & bench, const std::string & impl, int nThreads, std::size_t n, double seconds) {
+    std::cout << "{\"backend\":\"" << backend << "\",\"bench\":\"" << bench << "\",\"impl\":\"" << impl
+              << "\",\"threads\":" << nThreads << ",\"elements\":" << n << ",\"seconds\":" << seconds
+              << ",\"elements_per_sec\":" << (seconds > 0 ? n / seconds : 0) << "}\n";
+}
+
+// runs prepare() and then f() a few times, checks the result and returns the best time of f()
+template <typename Prepare, typename F, typename Check>
+static double best_of(Prepare prepare, F f, Check check) {
+    double best = 0;
+    for (int k = 0; k < nRuns; ++k) {
+        prepare();
+        auto start = Clock::now();
+        f();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (!check()) {
+            std::cerr << "wrong result\n";
+            std::exit(1);
+        }
+        if (k == 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+static void sort(const std::vector<int> & input, const std::vector<int> & threadCounts) {
+    std::vector<int> expected(input), v;
+    std::sort(expected.begin(), expected.end());
+    auto prepare = [&]() { v = input; };
+    auto check = [&]() { return v == expected; };
+    report("sort", "std", 1, input.size(), best_of(prepare, [&]() { std::sort(v.begin(), v.end()); }, check));
+#if _ctplBenchmarkPar_
+    report("sort", "std::execution::par", 0, input.size(), best_of(prepare, [&]() { std::sort(std::execution::par, v.begin(), v.end()); }, check));
+#endif
+    for (int nThreads : threadCounts) {
+        ctpl::thread_pool p(nThreads);
+        report("sort", "ctpl", nThreads, input.size(), best_of(prepare, [&]() { ctpl::parallel_sort(p, v.begin(), v.end()); }, check));
+    }
+}
+
+static double work(int x) {
+    return std::sqrt(static_cast<double>(x)) * std::log1p(static_cast<double>(x));
+}
+
+static void transform(const std::vector<int> & input, const std::vector<int> & threadCounts) {
+    std::vector<double> expected(input.size()), v(input.size());
+    std::transform(input.begin(), input.end(), expected.begin(), work);
+    auto prepare = [&]() { std::fill(v.begin(), v.end(), 0.0); };
+    auto check = [&]() { return v == expected; };
+    report("transform", "std", 1, input.size(), best_of(prepare, [&]() { std::transform(input.begin(), input.end(), v.begin(), work); }, check));
+#if _ctplBenchmarkPar_
+    report("transform", "std::execution::par", 0, input.size(), best_of(prepare, [&]() { std::transform(std::execution::par, input.begin(), input.end(), v.begin(), work); }, check));
+#endif
+    for (int nThreads : threadCounts) {
+        ctpl::thread_pool p(nThreads);
+        report("transform", "ctpl", nThreads, input.size(), best_of(prepare, [&]() { ctpl::parallel_transform(p, input.begin(), input.end(), v.begin(), work); }, check));
+    }
+}
+
+static void for_each(const std::vector<int> & input, const std::vector<int> & threadCounts) {
+    std::vector<double> expected(input.begin(), input.end()), v;
+    auto f = [](double & x) { x = work(static_cast<int>(x)); };
+    std::for_each(expected.begin(), expected.end(), f);
+    auto prepare = [&]() { v.assign(input.begin(), input.end()); };
+    auto check = [&]() { return v == expected; };
+    report("for_each", "std", 1, input.size(), best_of(prepare, [&]() { std::for_each(v.begin(), v.end(), f); }, check));
+#if _ctplBenchmarkPar_
+    report("for_each", "std::execution::par", 0, input.size(), best_of(prepare, [&]() { std::for_each(std::execution::par, v.begin(), v.end(), f); }, check));
+#endif
+    for (int nThreads : threadCounts) {
+        ctpl::thread_pool p(nThreads);
+        report("for_each", "ctpl", nThreads, input.size(), best_of(prepare, [&]() { ctpl::parallel_for_each(p, v.begin(), v.end(), f); }, check));
+    }
+}
+
+static void scan(const std::vector<int> & input, const std::vector<int> & threadCounts) {
+    std::vector<long long> values(input.begin(), input.end()), inclusive(input.size()), exclusive(input.size()), v(input.size());
+    std::partial_sum(values.begin(), values.end(), inclusive.begin());
+    exclusive[0] = 0;
+    std::copy(inclusive.begin(), inclusive.end() - 1, exclusive.begin() + 1);
+    auto prepare = [&]() { std::fill(v.begin(), v.end(), 0); };
+    auto checkInclusive = [&]() { return v == inclusive; };
+    auto checkExclusive = [&]() { return v == exclusive; };
+    report("inclusive_scan", "std", 1, input.size(), best_of(prepare, [&]() { std::partial_sum(values.begin(), values.end(), v.begin()); }, checkInclusive));
+#if _ctplBenchmarkPar_
+    report("inclusive_scan", "std::execution::par", 0, input.size(), best_of(prepare, [&]() { std::inclusive_scan(std::execution::par, values.begin(), values.end(), v.begin()); }, checkInclusive));
+    report("exclusive_scan", "std::execution::par", 0, input.size(), best_of(prepare, [&]() { std::exclusive_scan(std::execution::par, values.begin(), values.end(), v.begin(), 0LL); }, checkExclusive));
+#endif
+    for (int nThreads : threadCounts) {
+        ctpl::thread_pool p(nThreads);
+        report("inclusive_scan", "ctpl", nThreads, input.size(), best_of(prepare, [&]() { ctpl::parallel_inclusive_scan(p, values.begin(), values.end(), v.begin()); }, checkInclusive));
+        report("exclusive_scan", "ctpl", nThreads, input.size(), best_of(prepare, [&]() { ctpl::parallel_exclusive_scan(p, values.begin(), values.end(), v.begin(), 0LL); }, checkExclusive));
+    }
+}
+
+int main(int argc, char **argv) {
+    int maxThreads = argc > 1 ? std::atoi(argv[1]) : static_cast<int>(std::thread::hardware_concurrency());
+    long n = argc > 2 ? std::atol(argv[2]) : 10000000;
+    if (maxThreads < 1)
+        maxThreads = 1;
+    if (n < 1)
+        n = 1;
+
+    std::vector<int> threadCounts;
+    for (int k = 1; k < maxThreads; k *= 2)
+        threadCounts.push_back(k);
+    threadCounts.push_back(maxThreads);
+
+    std::mt19937 rng(12345);
+    std::vector<int> input(n);
+    for (auto & x : input)
+        x = static_cast<int>(rng() % 1000000);
+
+    sort(input, threadCounts);
+    transform(input, threadCounts);
+    for_each(input, threadCounts);
+    scan(input, threadCounts);
+
+    return 0;
+}
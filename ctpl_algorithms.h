@@ -0,0 +1,464 @@
+/*********************************************************
+*
+*  Copyright (C) 2014 by Vitaliy Vitsentiy
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*
+*********************************************************/
+
+
+#ifndef __ctpl_algorithms_H__
+#define __ctpl_algorithms_H__
+
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include <iterator>
+#include <functional>
+#include <vector>
+
+
+
+// parallel algorithms run on a thread pool of ctpl.h or ctpl_stl.h, include one of them before
+// the calling thread takes part in the work and returns when all of it is done
+// an exception thrown by the user's function stops the work that is not started yet and is rethrown to the caller
+
+
+namespace ctpl {
+
+    // how the index range is split into the chunks taken by the threads
+    enum class chunking {
+        equal,  // one chunk per thread taking part, the lowest overhead when the iterations take the same time
+        dynamic,  // chunks of the grain size, balances iterations that take different time
+        guided  // chunks getting smaller with the remaining work, but not smaller than the grain size
+    };
+
+    namespace detail {
+
+        // the state of a parallel loop shared by the calling thread and the threads of the pool that help it
+        // a thread that starts to help after the loop is finished takes no chunk, so it does not touch the user's function
+        template <typename Index>
+        class parallel_loop {
+        public:
+            parallel_loop(Index first, Index last, chunking mode, std::uint64_t grain, int nParts) :
+                first(first), n(last > first ? static_cast<std::uint64_t>(last - first) : 0), mode(mode), nParts(nParts), next(0), done(0) {
+                if (mode == chunking::equal)
+                    this->grain = (this->n + nParts - 1) / nParts;
+                else if (grain > 0)
+                    this->grain = grain;
+                else  // automatic
+                    this->grain = std::max<std::uint64_t>(1, this->n / (nParts * (mode == chunking::dynamic ? 16 : 64)));
+            }
+
+            std::uint64_t size() const { return this->n; }
+            std::uint64_t chunk_size() const { return this->grain; }
+
+            // part(first, begin, end) is called for the chunks taken by the calling thread until there are no more of them,
+            // then part.finish() is called before the iterations are counted as finished
+            template <typename Part>
+            void run(Part & part) {
+                std::uint64_t nDone = 0;
+                std::uint64_t begin, end;
+                while (this->take(begin, end)) {
+                    try {
+                        part(this->first, begin, end);
+                    }
+                    catch (...) {
+                        this->fail(std::current_exception(), nDone);
+                    }
+                    nDone += end - begin;
+                }
+                if (nDone == 0)
+                    return;
+                try {
+                    part.finish();
+                }
+                catch (...) {
+                    this->fail(std::current_exception(), nDone);
+                }
+                if (this->done.fetch_add(nDone, std::memory_order_acq_rel) + nDone == this->n) {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->cv.notify_all();
+                }
+            }
+
+            // waits for the chunks taken by the other threads, rethrows the first exception
+            void wait() {
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->cv.wait(lock, [this](){ return this->done.load(std::memory_order_acquire) == this->n; });
+                }
+                if (this->error)
+                    std::rethrow_exception(this->error);
+            }
+
+        private:
+            bool take(std::uint64_t & begin, std::uint64_t & end) {
+                if (this->mode != chunking::guided) {
+                    begin = this->next.fetch_add(this->grain, std::memory_order_relaxed);
+                    if (begin >= this->n)
+                        return false;
+                    end = std::min(this->n, begin + this->grain);
+                    return true;
+                }
+                begin = this->next.load(std::memory_order_relaxed);
+                while (begin < this->n) {
+                    std::uint64_t c = std::max(this->grain, (this->n - begin) / (2 * this->nParts));
+                    end = std::min(this->n, begin + c);
+                    if (this->next.compare_exchange_weak(begin, end, std::memory_order_relaxed))
+                        return true;
+                }
+                return false;
+            }
+
+            // no chunks are taken after an exception, the iterations not taken yet are counted as finished
+            void fail(std::exception_ptr e, std::uint64_t & nDone) {
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    if (!this->error)
+                        this->error = e;
+                }
+                std::uint64_t taken = this->next.exchange(this->n, std::memory_order_relaxed);
+                if (taken < this->n)
+                    nDone += this->n - taken;
+            }
+
+            Index first;
+            std::uint64_t n;
+            chunking mode;
+            std::uint64_t grain;
+            int nParts;
+            std::atomic<std::uint64_t> next;  // the first iteration not taken yet
+            std::atomic<std::uint64_t> done;  // the number of the finished iterations
+            std::exception_ptr error;
+            std::mutex mutex;
+            std::condition_variable cv;
+        };
+
+        // runs the chunks of [first, last) on the calling thread and the threads of the pool, each of them with its own copy of part
+        template <typename Pool, typename Index, typename Part>
+        void run_loop(Pool & pool, Index first, Index last, chunking mode, std::size_t grain, Part part) {
+            int nParts = pool.size() + 1;
+            auto loop = std::make_shared<parallel_loop<Index>>(first, last, mode, grain, nParts);
+            if (loop->size() == 0)
+                return;
+            std::uint64_t nChunks = (loop->size() + loop->chunk_size() - 1) / loop->chunk_size();
+            int nHelpers = static_cast<int>(std::min<std::uint64_t>(pool.size(), nChunks - 1));
+            for (int k = 0; k < nHelpers; ++k) {
+                pool.post([loop, part](int) mutable {
+                    loop->run(part);
+                });
+            }
+            loop->run(part);
+            loop->wait();
+        }
+
+        template <typename Index, typename F>
+        class for_part {
+        public:
+            for_part(F & f) : f(&f) {}
+            void operator()(Index first, std::uint64_t begin, std::uint64_t end) {
+                for (std::uint64_t k = begin; k < end; ++k)
+                    (*this->f)(static_cast<Index>(first + static_cast<Index>(k)));
+            }
+            void finish() {}
+        private:
+            F * f;
+        };
+
+        // keeps the partial result of the chunks run by one thread and combines it with the result once
+        template <typename Index, typename T, typename Map, typename Reduce>
+        class reduce_part {
+        public:
+            reduce_part(Map & map, Reduce & reduce, T & result, std::mutex & mutex) : map(&map), reduce(&reduce), result(&result), mutex(&mutex) {}
+            reduce_part(const reduce_part & other) : map(other.map), reduce(other.reduce), result(other.result), mutex(other.mutex) {}
+            void operator()(Index first, std::uint64_t begin, std::uint64_t end) {
+                std::uint64_t k = begin;
+                if (!this->partial)
+                    this->partial.reset(new T((*this->map)(static_cast<Index>(first + static_cast<Index>(k++)))));
+                for (; k < end; ++k)
+                    *this->partial = (*this->reduce)(std::move(*this->partial), (*this->map)(static_cast<Index>(first + static_cast<Index>(k))));
+            }
+            void finish() {
+                if (!this->partial)
+                    return;
+                std::unique_lock<std::mutex> lock(*this->mutex);
+                *this->result = (*this->reduce)(std::move(*this->result), std::move(*this->partial));
+            }
+        private:
+            Map * map;
+            Reduce * reduce;
+            T * result;
+            std::mutex * mutex;
+            std::unique_ptr<T> partial;
+        };
+
+        // calls f(begin, end) for the chunks of [0, n) taken by the thread
+        template <typename F>
+        class chunk_part {
+        public:
+            chunk_part(F & f) : f(&f) {}
+            void operator()(std::uint64_t, std::uint64_t begin, std::uint64_t end) { (*this->f)(begin, end); }
+            void finish() {}
+        private:
+            F * f;
+        };
+
+        template <typename Pool, typename F>
+        void run_chunks(Pool & pool, std::uint64_t n, chunking mode, std::size_t grain, F & f) {
+            run_loop(pool, static_cast<std::uint64_t>(0), n, mode, grain, chunk_part<F>(f));
+        }
+
+        // scans [first, last) into out with the carry of the previous blocks, the input may be the output
+        template <typename InputIt, typename OutputIt, typename T, typename Op>
+        void scan_block(InputIt first, InputIt last, OutputIt out, const T * carry, bool isExclusive, Op & op) {
+            if (isExclusive) {
+                T sum(*carry);
+                for (; first != last; ++first, ++out) {
+                    T next = op(sum, *first);
+                    *out = std::move(sum);
+                    sum = std::move(next);
+                }
+                return;
+            }
+            T sum = carry ? op(*carry, *first) : T(*first);
+            *out = sum;
+            for (++first, ++out; first != last; ++first, ++out) {
+                sum = op(std::move(sum), *first);
+                *out = sum;
+            }
+        }
+
+        // two passes over blocks of the input: the sums of the blocks, then the scans of the blocks starting with the sums before them
+        template <typename Pool, typename InputIt, typename OutputIt, typename T, typename Op>
+        OutputIt scan(Pool & pool, InputIt first, InputIt last, OutputIt out, const T * init, Op & op, std::size_t grain) {
+            typedef typename std::iterator_traits<InputIt>::difference_type Difference;
+            if (last <= first)
+                return out;
+            std::uint64_t n = static_cast<std::uint64_t>(last - first);
+            std::uint64_t nParts = static_cast<std::uint64_t>(pool.size() + 1);
+            std::uint64_t blockSize = grain > 0 ? grain : (n + nParts - 1) / nParts;
+            std::uint64_t nBlocks = (n + blockSize - 1) / blockSize;
+            if (nBlocks == 1) {
+                scan_block(first, last, out, init, init != nullptr, op);
+                return out + static_cast<Difference>(n);
+            }
+            auto at = [blockSize](std::uint64_t k) { return static_cast<Difference>(k * blockSize); };
+
+            std::vector<T> sums(nBlocks - 1, init ? *init : T(*first));
+            auto reduce = [&](std::uint64_t begin, std::uint64_t end) {
+                for (std::uint64_t k = begin; k < end; ++k) {
+                    InputIt it = first + at(k);
+                    InputIt blockLast = first + at(k + 1);
+                    T sum(*it);
+                    for (++it; it != blockLast; ++it)
+                        sum = op(std::move(sum), *it);
+                    sums[k] = std::move(sum);
+                }
+            };
+            run_chunks(pool, nBlocks - 1, chunking::dynamic, 1, reduce);
+
+            if (init)
+                sums[0] = op(*init, std::move(sums[0]));
+            for (std::uint64_t k = 1; k < nBlocks - 1; ++k)
+                sums[k] = op(sums[k - 1], std::move(sums[k]));
+
+            auto write = [&](std::uint64_t begin, std::uint64_t end) {
+                for (std::uint64_t k = begin; k < end; ++k) {
+                    InputIt blockLast = k + 1 < nBlocks ? first + at(k + 1) : last;
+                    scan_block(first + at(k), blockLast, out + at(k), k > 0 ? &sums[k - 1] : init, init != nullptr, op);
+                }
+            };
+            run_chunks(pool, nBlocks, chunking::dynamic, 1, write);
+            return out + static_cast<Difference>(n);
+        }
+
+        // the number of the elements of a and b among the first d elements of their merge, the elements of a go first on ties
+        template <typename Left, typename Right, typename Compare>
+        std::uint64_t co_rank(Left a, std::uint64_t na, Right b, std::uint64_t nb, std::uint64_t d, Compare & comp) {
+            std::uint64_t lo = d > nb ? d - nb : 0;
+            std::uint64_t hi = std::min(d, na);
+            while (lo < hi) {
+                std::uint64_t i = lo + (hi - lo) / 2;
+                std::uint64_t j = d - i;
+                if (j > 0 && !comp(b[j - 1], a[i]))
+                    lo = i + 1;
+                else
+                    hi = i;
+            }
+            return lo;
+        }
+
+        // merges the pairs of the sorted runs of the given width from source into destination
+        // the output is split into one piece per thread, each thread merges the part of the pairs falling into its piece
+        // the splits are found before the merges, which move from the elements compared by the splits of the other pieces
+        template <typename Pool, typename Source, typename Destination, typename Compare>
+        void merge_pass(Pool & pool, Source source, Destination destination, std::uint64_t n, std::uint64_t width, Compare & comp) {
+            typedef typename std::iterator_traits<Source>::difference_type Difference;
+            std::uint64_t nPieces = std::min<std::uint64_t>(n, static_cast<std::uint64_t>(pool.size() + 1));
+            auto at = [n, nPieces](std::uint64_t p) { return n / nPieces * p + std::min(p, n % nPieces); };
+            std::vector<std::uint64_t> ranks(nPieces + 1);  // the elements of the first run of its pair before the start of a piece
+            for (std::uint64_t p = 0; p <= nPieces; ++p) {
+                std::uint64_t d = at(p);
+                std::uint64_t start = d / (2 * width) * (2 * width);
+                std::uint64_t middle = std::min(n, start + width), stop = std::min(n, start + 2 * width);
+                ranks[p] = co_rank(source + static_cast<Difference>(start), middle - start, source + static_cast<Difference>(middle), stop - middle, d - start, comp);
+            }
+
+            auto merge = [&](std::uint64_t begin, std::uint64_t end) {
+                for (std::uint64_t p = begin; p < end; ++p) {
+                    std::uint64_t first = at(p), last = at(p + 1);
+                    for (std::uint64_t start = first / (2 * width) * (2 * width); start < last; start += 2 * width) {
+                        std::uint64_t middle = std::min(n, start + width), stop = std::min(n, start + 2 * width);
+                        std::uint64_t lo = std::max(first, start) - start, hi = std::min(last, stop) - start;
+                        std::uint64_t i0 = start < first ? ranks[p] : 0;
+                        std::uint64_t i1 = last < stop ? ranks[p + 1] : middle - start;
+                        Source a = source + static_cast<Difference>(start);
+                        Source b = source + static_cast<Difference>(middle);
+                        std::merge(std::make_move_iterator(a + static_cast<Difference>(i0)), std::make_move_iterator(a + static_cast<Difference>(i1)),
+                                   std::make_move_iterator(b + static_cast<Difference>(lo - i0)), std::make_move_iterator(b + static_cast<Difference>(hi - i1)),
+                                   destination + static_cast<Difference>(start + lo), comp);
+                    }
+                }
+            };
+            run_chunks(pool, nPieces, chunking::dynamic, 1, merge);
+        }
+
+    }
+
+    // calls f(i) for every i in [first, last), in parallel on the calling thread and the threads of the pool
+    // grain is the size of the chunks for chunking::dynamic and the smallest chunk for chunking::guided, 0 to choose it automatically
+    template <typename Pool, typename Index, typename F>
+    void parallel_for(Pool & pool, Index first, Index last, F && f, chunking mode = chunking::guided, std::size_t grain = 0) {
+        typedef typename std::remove_reference<F>::type Function;
+        detail::run_loop(pool, first, last, mode, grain, detail::for_part<Index, Function>(f));
+    }
+
+    // returns init combined by reduce(a, b) with map(i) for every i in [first, last), computed in parallel like parallel_for()
+    // reduce must be associative and commutative, the values are combined in no particular order
+    template <typename Pool, typename Index, typename T, typename Map, typename Reduce>
+    T parallel_reduce(Pool & pool, Index first, Index last, T init, Map && map, Reduce && reduce, chunking mode = chunking::guided, std::size_t grain = 0) {
+        typedef typename std::remove_reference<Map>::type MapFunction;
+        typedef typename std::remove_reference<Reduce>::type ReduceFunction;
+        std::mutex mutex;
+        T result(std::move(init));
+        detail::run_loop(pool, first, last, mode, grain, detail::reduce_part<Index, T, MapFunction, ReduceFunction>(map, reduce, result, mutex));
+        return result;
+    }
+
+    // calls f(x) for every element x of the random-access range [first, last), in parallel like parallel_for()
+    template <typename Pool, typename RandomIt, typename F>
+    void parallel_for_each(Pool & pool, RandomIt first, RandomIt last, F && f, chunking mode = chunking::guided, std::size_t grain = 0) {
+        typedef typename std::iterator_traits<RandomIt>::difference_type Difference;
+        auto each = [first, &f](std::uint64_t begin, std::uint64_t end) {
+            for (std::uint64_t k = begin; k < end; ++k)
+                f(first[static_cast<Difference>(k)]);
+        };
+        detail::run_chunks(pool, last > first ? static_cast<std::uint64_t>(last - first) : 0, mode, grain, each);
+    }
+
+    // stores op(x) for every element x of [first, last) to the range starting at out, which may be the input, and returns the end of the output
+    template <typename Pool, typename RandomIt, typename OutputIt, typename Op>
+    OutputIt parallel_transform(Pool & pool, RandomIt first, RandomIt last, OutputIt out, Op && op, chunking mode = chunking::guided, std::size_t grain = 0) {
+        typedef typename std::iterator_traits<RandomIt>::difference_type Difference;
+        std::uint64_t n = last > first ? static_cast<std::uint64_t>(last - first) : 0;
+        auto transform = [first, out, &op](std::uint64_t begin, std::uint64_t end) {
+            for (std::uint64_t k = begin; k < end; ++k)
+                out[static_cast<Difference>(k)] = op(first[static_cast<Difference>(k)]);
+        };
+        detail::run_chunks(pool, n, mode, grain, transform);
+        return out + static_cast<Difference>(n);
+    }
+
+    // the scans store to the range starting at out, which may be the input, and return the end of the output
+    // op must be associative, the input is read twice: once for the sums of the blocks given to the threads, once for the scans of the blocks
+    // grain is the size of the blocks, 0 for one block per thread taking part
+
+    // out[i] = x[0] op x[1] op ... op x[i]
+    template <typename Pool, typename RandomIt, typename OutputIt, typename Op>
+    OutputIt parallel_inclusive_scan(Pool & pool, RandomIt first, RandomIt last, OutputIt out, Op && op, std::size_t grain = 0) {
+        typedef typename std::iterator_traits<RandomIt>::value_type T;
+        return detail::scan(pool, first, last, out, static_cast<const T *>(nullptr), op, grain);
+    }
+
+    template <typename Pool, typename RandomIt, typename OutputIt>
+    OutputIt parallel_inclusive_scan(Pool & pool, RandomIt first, RandomIt last, OutputIt out) {
+        return parallel_inclusive_scan(pool, first, last, out, std::plus<typename std::iterator_traits<RandomIt>::value_type>());
+    }
+
+    // out[0] = init, out[i] = init op x[0] op ... op x[i - 1]
+    template <typename Pool, typename RandomIt, typename OutputIt, typename T, typename Op>
+    OutputIt parallel_exclusive_scan(Pool & pool, RandomIt first, RandomIt last, OutputIt out, T init, Op && op, std::size_t grain = 0) {
+        return detail::scan(pool, first, last, out, &init, op, grain);
+    }
+
+    template <typename Pool, typename RandomIt, typename OutputIt, typename T>
+    OutputIt parallel_exclusive_scan(Pool & pool, RandomIt first, RandomIt last, OutputIt out, T init) {
+        return parallel_exclusive_scan(pool, first, last, out, std::move(init), std::plus<T>());
+    }
+
+    // sorts [first, last) by comp, not stable: the runs given to the threads are sorted with std::sort, then merged in pairs
+    // with all the threads taking part in every merge, through a buffer of the size of the range
+    // grain is the smallest run sorted by one thread, 0 to choose it automatically
+    // if comp throws, the order of the elements and the values of some of them are unspecified
+    template <typename Pool, typename RandomIt, typename Compare>
+    void parallel_sort(Pool & pool, RandomIt first, RandomIt last, Compare comp, std::size_t grain = 0) {
+        typedef typename std::iterator_traits<RandomIt>::difference_type Difference;
+        typedef typename std::iterator_traits<RandomIt>::value_type T;
+        if (last - first < 2)
+            return;
+        std::uint64_t n = static_cast<std::uint64_t>(last - first);
+        std::uint64_t nParts = static_cast<std::uint64_t>(pool.size() + 1);
+        std::uint64_t runSize = grain > 0 ? grain : std::max<std::uint64_t>(1024, (n + nParts - 1) / nParts);
+        if (runSize >= n || nParts == 1) {
+            std::sort(first, last, comp);
+            return;
+        }
+
+        auto sortRuns = [&](std::uint64_t begin, std::uint64_t end) {
+            for (std::uint64_t k = begin; k < end; ++k)
+                std::sort(first + static_cast<Difference>(k * runSize), first + static_cast<Difference>(std::min(n, (k + 1) * runSize)), comp);
+        };
+        detail::run_chunks(pool, (n + runSize - 1) / runSize, chunking::dynamic, 1, sortRuns);
+
+        // the merges go back and forth between the buffer and the range
+        std::vector<T> buffer(std::make_move_iterator(first), std::make_move_iterator(last));
+        bool isInBuffer = true;
+        for (std::uint64_t width = runSize; width < n; width *= 2, isInBuffer = !isInBuffer) {
+            if (isInBuffer)
+                detail::merge_pass(pool, buffer.begin(), first, n, width, comp);
+            else
+                detail::merge_pass(pool, first, buffer.begin(), n, width, comp);
+        }
+        if (isInBuffer) {
+            auto moveBack = [&](std::uint64_t begin, std::uint64_t end) {
+                std::move(buffer.begin() + static_cast<Difference>(begin), buffer.begin() + static_cast<Difference>(end), first + static_cast<Difference>(begin));
+            };
+            detail::run_chunks(pool, n, chunking::equal, 0, moveBack);
+        }
+    }
+
+    template <typename Pool, typename RandomIt>
+    void parallel_sort(Pool & pool, RandomIt first, RandomIt last) {
+        parallel_sort(pool, first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+    }
+
+}
+
+#endif // __ctpl_algorithms_H__
@@ -0,0 +1,4524 @@
+/*********************************************************
+*
+*  Copyright (C) 2014 by Vitaliy Vitsentiy
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*
+*********************************************************/
+
+
+#ifndef __ctpl_core_H__
+#define __ctpl_core_H__
+
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <deque>
+#include <cstdint>
+#include <chrono>
+#include <condition_variable>
+#include <type_traits>
+#include <new>
+#include <iterator>
+#include <algorithm>
+#include <string>
+#include <fstream>
+#include <ostream>
+#include <cstdlib>
+#include <initializer_list>
+#include <tuple>
+#include <stdexcept>
+#include <limits>
+#include <cstddef>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+#ifndef _ctplThreadPoolLength_
+#define _ctplThreadPoolLength_  100  // the expected length of the queue, for the queue policies that preallocate
+#endif
+
+#ifndef _ctplThreadPoolStats_
+#define _ctplThreadPoolStats_  0  // 1 to count the functors and their times, see thread_pool::stats()
+#endif
+
+#ifndef _ctplThreadPoolArena_
+#define _ctplThreadPoolArena_  0  // 1 to allocate the functors and the shared states of the futures from the caches of the threads
+#endif
+
+#ifndef _ctplThreadPoolTrace_
+#define _ctplThreadPoolTrace_  0  // how many of the last functors each thread keeps the times of, 0 for none, see thread_pool::write_trace()
+#endif
+
+#ifndef _ctplThreadPoolCoroutines_
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define _ctplThreadPoolCoroutines_  1  // co_await pool.schedule() and ctpl::task, on by default with the c++20 coroutines
+#else
+#define _ctplThreadPoolCoroutines_  0
+#endif
+#endif
+
+#if _ctplThreadPoolCoroutines_
+#include <coroutine>
+#include <optional>
+#include <utility>
+#endif
+
+
+// the thread pool shared by ctpl.h and ctpl_stl.h, they choose its queue, include one of them instead of this header
+
+// thread pool to run user's functors with signature
+//      ret func(int id, other_params)
+// where id is the index of the thread that runs the functor
+// ret is some return type
+
+
+namespace ctpl {
+
+    namespace detail {
+
+        // tells the cpu that the thread is spinning, so it gives resources to the other hyperthread and saves power
+        inline void cpu_relax() {
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+            _mm_pause();
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+            __builtin_ia32_pause();
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__aarch64__) || defined(__arm__))
+            __asm__ __volatile__("yield");
+#endif
+        }
+
+        // the cpus of a list like "0-3,8,10-11" as in /sys/devices/system
+        inline std::vector<int> parse_cpu_list(const std::string & list) {
+            std::vector<int> cpus;
+            std::size_t k = 0;
+            while (k < list.size()) {
+                std::size_t end = list.find(',', k);
+                if (end == std::string::npos)
+                    end = list.size();
+                std::string range = list.substr(k, end - k);
+                std::size_t dash = range.find('-');
+                int first = std::atoi(range.c_str());
+                int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+                if (!range.empty() && range[0] >= '0' && range[0] <= '9') {
+                    for (int cpu = first; cpu <= last; ++cpu)
+                        cpus.push_back(cpu);
+                }
+                k = end + 1;
+            }
+            return cpus;
+        }
+
+        // the cpus of each numa node that the process may run on, the nodes without such cpus are left out
+        // one node with all the cpus if there is no numa information
+        inline std::vector<std::vector<int>> numa_nodes() {
+            std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+            cpu_set_t allowed;
+            CPU_ZERO(&allowed);
+            bool isAllowedKnown = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+            auto isAllowed = [&](int cpu) { return !isAllowedKnown || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)); };
+            std::string list;
+            std::ifstream online("/sys/devices/system/node/online");
+            if (std::getline(online, list)) {
+                for (int node : parse_cpu_list(list)) {
+                    std::string cpuList;
+                    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                    std::vector<int> cpus;
+                    if (std::getline(file, cpuList)) {
+                        for (int cpu : parse_cpu_list(cpuList)) {
+                            if (isAllowed(cpu))
+                                cpus.push_back(cpu);
+                        }
+                    }
+                    if (!cpus.empty())
+                        nodes.push_back(cpus);
+                }
+            }
+            if (nodes.empty() && isAllowedKnown) {
+                std::vector<int> cpus;
+                for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                    if (CPU_ISSET(cpu, &allowed))
+                        cpus.push_back(cpu);
+                }
+                nodes.push_back(cpus);
+            }
+#endif
+            if (nodes.empty()) {
+                std::vector<int> cpus;
+                for (int cpu = 0, n = static_cast<int>(std::thread::hardware_concurrency()); cpu < n; ++cpu)
+                    cpus.push_back(cpu);
+                nodes.push_back(cpus);
+            }
+            return nodes;
+        }
+
+        // pins the calling thread to the cpus, returns false if it is not supported or failed
+        inline bool pin_this_thread(const std::vector<int> & cpus) {
+#if defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int cpu : cpus) {
+                if (cpu >= 0 && cpu < CPU_SETSIZE)
+                    CPU_SET(cpu, &set);
+            }
+            return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+            return false;
+#endif
+        }
+
+        // the cpu the calling thread runs on, -1 if it is not known
+        inline int current_cpu() {
+#if defined(__linux__)
+            return sched_getcpu();
+#else
+            return -1;
+#endif
+        }
+
+        template <typename T>
+        class Queue {
+        public:
+            bool push(T && value) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->q.push(std::move(value));
+                return true;
+            }
+            // moves the elements of the range to the queue under one lock, returns the end of the moved elements
+            template <typename It>
+            It push(It first, It last) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                for (; first != last; ++first)
+                    this->q.push(std::move(*first));
+                return last;
+            }
+            // moves the retrieved element to v and deletes it from the queue
+            bool pop(T & v) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                if (this->q.empty())
+                    return false;
+                v = std::move(this->q.front());
+                this->q.pop();
+                return true;
+            }
+            // moves up to n elements to out under one lock, but not more than 1 / nShares of the queue, rounded up
+            int pop(T * out, int n, int nShares) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                int k = static_cast<int>(std::min<std::size_t>(n, (this->q.size() + nShares - 1) / nShares));
+                for (int j = 0; j < k; ++j) {
+                    out[j] = std::move(this->q.front());
+                    this->q.pop();
+                }
+                return k;
+            }
+            bool empty() {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                return this->q.empty();
+            }
+        private:
+            std::queue<T> q;
+            std::mutex mutex;
+        };
+
+        // lock-free bounded multi-producer multi-consumer ring, see "Bounded MPMC queue" by D. Vyukov
+        // the sequence number of a slot tells the push of which position may fill it and the pop of which position may empty it
+        // the slots and the two positions are on cache lines of their own
+        // when the ring is full the values go to a queue under a mutex, the later pushes too until it is empty, so the order is kept
+        template <typename T>
+        class RingQueue {
+        public:
+            explicit RingQueue(std::size_t size) : head(0), tail(0), nOverflow(0) {
+                std::size_t n = 2;
+                while (n < size)
+                    n *= 2;
+                this->mask = n - 1;
+                this->memory.reset(new char[n * sizeof(Slot) + cacheLine]);
+                std::uintptr_t address = reinterpret_cast<std::uintptr_t>(this->memory.get());
+                this->slots = reinterpret_cast<Slot *>((address + cacheLine - 1) & ~static_cast<std::uintptr_t>(cacheLine - 1));
+                for (std::size_t k = 0; k < n; ++k)
+                    new (&this->slots[k]) Slot(k);
+            }
+            ~RingQueue() {
+                T v;
+                while (this->pop_ring(v))
+                    ;
+                for (std::size_t k = 0; k <= this->mask; ++k)
+                    this->slots[k].~Slot();
+            }
+
+            bool push(T && value) {
+                if (this->nOverflow.load(std::memory_order_acquire) > 0 || !this->push_ring(value)) {
+                    this->overflow.push(std::move(value));
+                    this->nOverflow.fetch_add(1, std::memory_order_acq_rel);
+                }
+                return true;
+            }
+            template <typename It>
+            It push(It first, It last) {
+                for (; first != last; ++first)
+                    this->push(std::move(*first));
+                return last;
+            }
+            bool pop(T & v) {
+                if (this->pop_ring(v))
+                    return true;
+                if (this->nOverflow.load(std::memory_order_acquire) <= 0 || !this->overflow.pop(v))
+                    return false;
+                this->nOverflow.fetch_sub(1, std::memory_order_acq_rel);
+                return true;
+            }
+            // takes up to n values with one move of the head, but not more than 1 / nShares of the ring, rounded up
+            int pop(T * out, int n, int nShares) {
+                int k = this->pop_ring(out, n, nShares);
+                if (k > 0 || this->nOverflow.load(std::memory_order_acquire) <= 0)
+                    return k;
+                k = this->overflow.pop(out, n, nShares);
+                this->nOverflow.fetch_sub(k, std::memory_order_acq_rel);
+                return k;
+            }
+            bool empty() {
+                return this->head.load(std::memory_order_acquire) == this->tail.load(std::memory_order_acquire) &&
+                       this->nOverflow.load(std::memory_order_acquire) <= 0;
+            }
+
+        private:
+            RingQueue(const RingQueue &);// = delete;
+            RingQueue & operator=(const RingQueue &);// = delete;
+
+            static const std::size_t cacheLine = 64;
+
+            struct Cell {
+                explicit Cell(std::size_t seq) : seq(seq) {}
+                std::atomic<std::size_t> seq;
+                typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+            };
+            struct Slot : Cell {
+                explicit Slot(std::size_t seq) : Cell(seq) {}
+                char pad[cacheLine - sizeof(Cell) % cacheLine];
+            };
+
+            // moves the value only if there is a free slot
+            bool push_ring(T & value) {
+                std::size_t pos = this->tail.load(std::memory_order_relaxed);
+                Slot * slot;
+                while (true) {
+                    slot = &this->slots[pos & this->mask];
+                    std::size_t seq = slot->seq.load(std::memory_order_acquire);
+                    std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+                    if (diff == 0) {
+                        if (this->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                            break;
+                    }
+                    else if (diff < 0)
+                        return false;  // full
+                    else
+                        pos = this->tail.load(std::memory_order_relaxed);
+                }
+                new (&slot->storage) T(std::move(value));
+                slot->seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            bool pop_ring(T & v) {
+                std::size_t pos = this->head.load(std::memory_order_relaxed);
+                Slot * slot;
+                while (true) {
+                    slot = &this->slots[pos & this->mask];
+                    std::size_t seq = slot->seq.load(std::memory_order_acquire);
+                    std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+                    if (diff == 0) {
+                        if (this->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                            break;
+                    }
+                    else if (diff < 0)
+                        return false;  // empty
+                    else
+                        pos = this->head.load(std::memory_order_relaxed);
+                }
+                T * value = reinterpret_cast<T *>(&slot->storage);
+                v = std::move(*value);
+                value->~T();
+                slot->seq.store(pos + this->mask + 1, std::memory_order_release);
+                return true;
+            }
+
+            // the filled slots from the head on are counted, then all of them are taken at once
+            int pop_ring(T * out, int n, int nShares) {
+                std::size_t pos = this->head.load(std::memory_order_relaxed);
+                std::size_t k;
+                while (true) {
+                    std::size_t length = this->tail.load(std::memory_order_relaxed) - pos;
+                    std::size_t most = std::min<std::size_t>(n, (std::min(length, this->mask + 1) + nShares - 1) / nShares);
+                    for (k = 0; k < most; ++k) {
+                        std::size_t seq = this->slots[(pos + k) & this->mask].seq.load(std::memory_order_acquire);
+                        if (seq != pos + k + 1)
+                            break;
+                    }
+                    if (k == 0) {
+                        std::size_t seq = this->slots[pos & this->mask].seq.load(std::memory_order_acquire);
+                        if (static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1) < 0)
+                            return 0;  // empty
+                        pos = this->head.load(std::memory_order_relaxed);  // taken by another pop meanwhile
+                        continue;
+                    }
+                    if (this->head.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed))
+                        break;
+                }
+                for (std::size_t j = 0; j < k; ++j) {
+                    Slot * slot = &this->slots[(pos + j) & this->mask];
+                    T * value = reinterpret_cast<T *>(&slot->storage);
+                    out[j] = std::move(*value);
+                    value->~T();
+                    slot->seq.store(pos + j + this->mask + 1, std::memory_order_release);
+                }
+                return static_cast<int>(k);
+            }
+
+            std::unique_ptr<char[]> memory;
+            Slot * slots;
+            std::size_t mask;
+            char padHead[cacheLine];
+            std::atomic<std::size_t> head;  // the position of the next pop
+            char padTail[cacheLine];
+            std::atomic<std::size_t> tail;  // the position of the next push
+            char padOverflow[cacheLine];
+            std::atomic<int> nOverflow;  // the values in the overflow queue
+            Queue<T> overflow;
+        };
+
+        // Chase-Lev work stealing deque, see "Dynamic Circular Work-Stealing Deque" by D. Chase and Y. Lev
+        // and "Correct and Efficient Work-Stealing for Weak Memory Models" by N. M. Le et al.
+        // only the owner thread may push and pop, at the bottom, any thread may steal from the top
+        // T must be trivially copyable, e.g. a pointer
+        template <typename T>
+        class WorkStealingDeque {
+        public:
+            WorkStealingDeque() : top(0), bottom(0), array(new Array(64)) {}
+            ~WorkStealingDeque() { delete this->array.load(std::memory_order_relaxed); }
+
+            // called by the owner only
+            void push(T const & value) {
+                std::int64_t b = this->bottom.load(std::memory_order_relaxed);
+                std::int64_t t = this->top.load(std::memory_order_acquire);
+                Array * a = this->array.load(std::memory_order_relaxed);
+                if (b - t > a->size - 1)
+                    a = this->grow(a, t, b);
+                a->put(b, value);
+                this->bottom.store(b + 1, std::memory_order_release);  // not a fence and a relaxed store, so the thread sanitizer sees the order
+            }
+            // called by the owner only, takes the most recently pushed element
+            bool pop(T & v) {
+                std::int64_t b = this->bottom.load(std::memory_order_relaxed) - 1;
+                Array * a = this->array.load(std::memory_order_relaxed);
+                this->bottom.store(b, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                std::int64_t t = this->top.load(std::memory_order_relaxed);
+                if (t > b) {  // empty
+                    this->bottom.store(b + 1, std::memory_order_relaxed);
+                    return false;
+                }
+                v = a->get(b);
+                if (t == b) {  // the last element, race with the thieves for it
+                    bool isWon = this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                    this->bottom.store(b + 1, std::memory_order_relaxed);
+                    return isWon;
+                }
+                return true;
+            }
+            // may be called by any thread, takes the least recently pushed element
+            // returns false if the deque is empty or another thread took the element first
+            bool steal(T & v) {
+                std::int64_t t = this->top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                std::int64_t b = this->bottom.load(std::memory_order_acquire);
+                if (t >= b)
+                    return false;
+                Array * a = this->array.load(std::memory_order_acquire);
+                T value = a->get(t);
+                if (!this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    return false;
+                v = value;
+                return true;
+            }
+            bool empty() const {
+                std::int64_t t = this->top.load(std::memory_order_acquire);
+                std::int64_t b = this->bottom.load(std::memory_order_acquire);
+                return t >= b;
+            }
+        private:
+            struct Array {
+                Array(std::int64_t size) : size(size), buffer(new std::atomic<T>[static_cast<std::size_t>(size)]) {}
+                T get(std::int64_t i) const { return this->buffer[i & (this->size - 1)].load(std::memory_order_relaxed); }
+                void put(std::int64_t i, T const & value) { this->buffer[i & (this->size - 1)].store(value, std::memory_order_relaxed); }
+                std::int64_t size;  // power of 2
+                std::unique_ptr<std::atomic<T>[]> buffer;
+            };
+
+            Array * grow(Array * a, std::int64_t t, std::int64_t b) {
+                Array * bigger = new Array(a->size * 2);
+                for (std::int64_t i = t; i < b; ++i)
+                    bigger->put(i, a->get(i));
+                // a thief may still be reading the old array, keep it until the deque is destroyed
+                this->oldArrays.emplace_back(a);
+                this->array.store(bigger, std::memory_order_release);
+                return bigger;
+            }
+
+            std::atomic<std::int64_t> top;  // written by the thieves
+            char padBottom[64];
+            std::atomic<std::int64_t> bottom;  // written by the owner
+            std::atomic<Array *> array;
+            std::vector<std::unique_ptr<Array>> oldArrays;
+        };
+
+#if _ctplThreadPoolStats_ || _ctplThreadPoolTrace_
+        inline std::int64_t now_ns() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+#endif
+
+#if _ctplThreadPoolTrace_
+        // the tag of the functors pushed by this thread now, see trace_scope
+        inline const char *& this_trace_tag() {
+            static thread_local const char * tag = nullptr;
+            return tag;
+        }
+#endif
+
+        // tags the functors pushed by this thread while it lives, does nothing without _ctplThreadPoolTrace_
+        class trace_scope {
+        public:
+#if _ctplThreadPoolTrace_
+            explicit trace_scope(const char * tag) : previous(this_trace_tag()) { this_trace_tag() = tag; }
+            ~trace_scope() { this_trace_tag() = this->previous; }
+#else
+            explicit trace_scope(const char *) {}
+#endif
+
+        private:
+            trace_scope(const trace_scope &);// = delete;
+            trace_scope & operator=(const trace_scope &);// = delete;
+#if _ctplThreadPoolTrace_
+            const char * previous;
+#endif
+        };
+
+#if _ctplThreadPoolArena_
+        // the memory blocks of one thread in size classes of 64 to 2048 bytes, taken from the global allocator once and reused
+        // a block freed by another thread is put to the remote list, the owner takes the whole list when it runs out of blocks
+        // the blocks are given back to the global allocator when the owner thread is gone and they are freed
+        class block_heap {
+        public:
+            static const int nClasses = 6;
+
+            struct link {
+                link * next;
+            };
+            union header {  // before each block, keeps the block aligned as by ::operator new
+                struct {
+                    block_heap * owner;  // nullptr for the blocks of the global allocator
+                    int sizeClass;
+                } info;
+                std::max_align_t aligner;
+            };
+
+            block_heap() : remote(nullptr), nRefs(1) {
+                for (int c = 0; c < nClasses; ++c)
+                    this->local[c] = nullptr;
+            }
+
+            static std::size_t class_size(int c) { return std::size_t(64) << c; }
+            static int class_of(std::size_t n) {
+                int c = 0;
+                while (c < nClasses && class_size(c) < n)
+                    ++c;
+                return c;  // nClasses if it is too big
+            }
+            static header * header_of(void * p) { return static_cast<header *>(p) - 1; }
+
+            // only by the owner thread
+            void * allocate(int c) {
+                if (!this->local[c])
+                    this->take_remote();
+                link * b = this->local[c];
+                if (b) {
+                    this->local[c] = b->next;
+                    return b;
+                }
+                this->nRefs.fetch_add(1, std::memory_order_relaxed);
+                header * h = static_cast<header *>(::operator new(sizeof(header) + class_size(c)));
+                h->info.owner = this;
+                h->info.sizeClass = c;
+                return h + 1;
+            }
+            void free_local(void * p) {
+                link * b = static_cast<link *>(p);
+                int c = header_of(p)->info.sizeClass;
+                b->next = this->local[c];
+                this->local[c] = b;
+            }
+
+            // by the other threads, the n blocks linked from first to last at once
+            void free_remote(link * first, link * last, long n) {
+                link * head = this->remote.load(std::memory_order_relaxed);
+                do {
+                    if (head == orphaned()) {
+                        last->next = nullptr;  // a failed exchange left it at a chain the owner may have freed since
+                        free_chain(first);
+                        this->release(n);
+                        return;
+                    }
+                    last->next = head;
+                } while (!this->remote.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+            }
+
+            // when the owner thread exits, the heap is deleted with its last block
+            void orphan() {
+                long n = free_chain(this->remote.exchange(orphaned(), std::memory_order_acquire));
+                for (int c = 0; c < nClasses; ++c) {
+                    n += free_chain(this->local[c]);
+                    this->local[c] = nullptr;
+                }
+                this->release(n + 1);
+            }
+
+        private:
+            void take_remote() {
+                if (!this->remote.load(std::memory_order_relaxed))
+                    return;
+                link * b = this->remote.exchange(nullptr, std::memory_order_acquire);
+                while (b) {
+                    link * next = b->next;
+                    this->free_local(b);
+                    b = next;
+                }
+            }
+            static long free_chain(link * b) {
+                long n = 0;
+                while (b) {
+                    link * next = b->next;
+                    ::operator delete(header_of(b));
+                    b = next;
+                    ++n;
+                }
+                return n;
+            }
+            void release(long n) {
+                if (this->nRefs.fetch_sub(n, std::memory_order_acq_rel) == n)
+                    delete this;
+            }
+            static link * orphaned() {
+                static link sentinel;
+                return &sentinel;
+            }
+
+            link * local[nClasses];
+            std::atomic<link *> remote;
+            std::atomic<long> nRefs;  // the blocks taken from the global allocator and not given back yet, and one for the owner thread
+        };
+
+        // the heap of a thread and the blocks it freed for another heap, given back together
+        class block_cache {
+        public:
+            static const long batch = 32;
+
+            block_cache() : heap(new block_heap()), pendingOwner(nullptr), first(nullptr), last(nullptr), nPending(0) {}
+            ~block_cache() {
+                this->flush();
+                this->heap->orphan();
+            }
+
+            void * allocate(int c) { return this->heap->allocate(c); }
+            void deallocate(void * p, block_heap * owner) {
+                if (owner == this->heap) {
+                    this->heap->free_local(p);
+                    return;
+                }
+                if (owner != this->pendingOwner)
+                    this->flush();
+                block_heap::link * b = static_cast<block_heap::link *>(p);
+                b->next = this->first;
+                if (!this->first)
+                    this->last = b;
+                this->first = b;
+                this->pendingOwner = owner;
+                if (++this->nPending == batch)
+                    this->flush();
+            }
+            void flush() {
+                if (this->nPending > 0)
+                    this->pendingOwner->free_remote(this->first, this->last, this->nPending);
+                this->pendingOwner = nullptr;
+                this->first = this->last = nullptr;
+                this->nPending = 0;
+            }
+
+        private:
+            block_cache(const block_cache &);// = delete;
+            block_cache & operator=(const block_cache &);// = delete;
+
+            block_heap * heap;
+            block_heap * pendingOwner;
+            block_heap::link * first;
+            block_heap::link * last;
+            long nPending;
+        };
+
+        // nullptr once the thread is exiting, its blocks are then freed as by another thread
+        inline block_cache * this_cache() {
+            static thread_local bool isGone = false;
+            struct holder {
+                block_cache cache;
+                ~holder() { isGone = true; }
+            };
+            if (isGone)
+                return nullptr;
+            static thread_local holder h;
+            return &h.cache;
+        }
+
+        inline void * allocate_block(std::size_t n) {
+            int c = block_heap::class_of(n);
+            block_cache * cache = this_cache();
+            if (c < block_heap::nClasses && cache)
+                return cache->allocate(c);
+            block_heap::header * h = static_cast<block_heap::header *>(::operator new(sizeof(block_heap::header) + n));
+            h->info.owner = nullptr;
+            return h + 1;
+        }
+        inline void free_block(void * p) {
+            if (!p)
+                return;
+            block_heap::header * h = block_heap::header_of(p);
+            block_heap * owner = h->info.owner;
+            block_cache * cache = owner ? this_cache() : nullptr;
+            if (!owner)
+                ::operator delete(h);
+            else if (cache)
+                cache->deallocate(p, owner);
+            else {
+                block_heap::link * b = static_cast<block_heap::link *>(p);
+                owner->free_remote(b, b, 1);
+            }
+        }
+        // gives back the blocks freed by this thread for the other threads, before it waits
+        inline void flush_blocks() {
+            block_cache * cache = this_cache();
+            if (cache)
+                cache->flush();
+        }
+#else
+        inline void * allocate_block(std::size_t n) { return ::operator new(n); }
+        inline void free_block(void * p) { ::operator delete(p); }
+        inline void flush_blocks() {}
+#endif
+
+        // a functor allocated by allocate_block(), the over-aligned ones by new
+        template <typename F, bool isBlock = std::alignment_of<F>::value <= std::alignment_of<std::max_align_t>::value>
+        struct block {
+            template <typename... G>
+            static F * create(G &&... g) {
+                void * p = allocate_block(sizeof(F));
+                try {
+                    return new (p) F(std::forward<G>(g)...);
+                }
+                catch (...) {
+                    free_block(p);
+                    throw;
+                }
+            }
+            static void destroy(F * f) {
+                f->~F();
+                free_block(f);
+            }
+        };
+        template <typename F>
+        struct block<F, false> {
+            template <typename... G>
+            static F * create(G &&... g) { return new F(std::forward<G>(g)...); }
+            static void destroy(F * f) { delete f; }
+        };
+
+        // the tag of the constructors that make the functor F in place from their arguments
+        template <typename F>
+        struct emplace {};
+
+        // move only wrapper of the functors run by the threads, called with the id of the running thread
+        // the functors that fit into the wrapper and do not throw when moved are stored in place, the others are allocated
+        class task {
+        public:
+            task() : ops(nullptr) {}
+            template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, task>::value>::type>
+            task(F && f) : ops(holder<typename std::decay<F>::type>::table()) {
+                holder<typename std::decay<F>::type>::create(&this->storage, std::forward<F>(f));
+            }
+            template <typename F, typename... Args>
+            task(emplace<F>, Args &&... args) : ops(holder<F>::table()) {
+                holder<F>::create(&this->storage, std::forward<Args>(args)...);
+            }
+            task(task && other) noexcept : ops(other.ops) {  // the functors stored in place do not throw when moved
+                if (this->ops)
+                    this->ops->move(&other.storage, &this->storage);
+                other.ops = nullptr;
+#if _ctplThreadPoolStats_ || _ctplThreadPoolTrace_
+                this->pushed = other.pushed;
+#endif
+#if _ctplThreadPoolTrace_
+                this->tag = other.tag;
+#endif
+            }
+            task & operator=(task && other) noexcept {
+                if (this != &other) {
+                    this->reset();
+                    if (other.ops)
+                        other.ops->move(&other.storage, &this->storage);
+                    this->ops = other.ops;
+                    other.ops = nullptr;
+#if _ctplThreadPoolStats_ || _ctplThreadPoolTrace_
+                    this->pushed = other.pushed;
+#endif
+#if _ctplThreadPoolTrace_
+                    this->tag = other.tag;
+#endif
+                }
+                return *this;
+            }
+            ~task() { this->reset(); }
+
+            void operator()(int id) { this->ops->call(&this->storage, id); }
+            explicit operator bool() const { return this->ops != nullptr; }
+            // deletes the functor
+            void reset() {
+                if (this->ops) {
+                    this->ops->destroy(&this->storage);
+                    this->ops = nullptr;
+                }
+            }
+
+            // notes the time the functor is pushed, and the tag of the pushing thread if it has none yet
+            void stamp() {
+#if _ctplThreadPoolStats_ || _ctplThreadPoolTrace_
+                this->pushed = now_ns();
+#endif
+#if _ctplThreadPoolTrace_
+                if (!this->tag)
+                    this->tag = this_trace_tag();
+#endif
+            }
+
+#if _ctplThreadPoolStats_ || _ctplThreadPoolTrace_
+            std::int64_t pushed = 0;
+#endif
+#if _ctplThreadPoolTrace_
+            const char * tag = nullptr;
+#endif
+
+            static const std::size_t capacity = 48;  // bytes for a functor stored in place, the wrapper takes 64 bytes, 72 with the stats, 80 with the trace
+
+#if _ctplThreadPoolArena_
+            // for the wrappers in the deques of the threads
+            static void * operator new(std::size_t n) { return allocate_block(n); }
+            static void operator delete(void * p) { free_block(p); }
+            static void * operator new(std::size_t, void * p) { return p; }
+            static void operator delete(void *, void *) {}
+#endif
+
+        private:
+            task(const task &);// = delete;
+            task & operator=(const task &);// = delete;
+
+            struct operations {
+                void (*call)(void * f, int id);
+                void (*move)(void * from, void * to);  // also destroys the moved from functor
+                void (*destroy)(void * f);
+            };
+
+            typedef std::aligned_storage<capacity>::type storage_type;
+
+            template <typename F, bool isInPlace = sizeof(F) <= sizeof(storage_type) && std::alignment_of<F>::value <= std::alignment_of<storage_type>::value
+                && std::is_nothrow_move_constructible<F>::value>
+            struct holder {  // the functor is stored in place
+                template <typename... G>
+                static void create(void * p, G &&... g) { new (p) F(std::forward<G>(g)...); }
+                static void call(void * f, int id) { (*static_cast<F *>(f))(id); }
+                static void move(void * from, void * to) {
+                    new (to) F(std::move(*static_cast<F *>(from)));
+                    static_cast<F *>(from)->~F();
+                }
+                static void destroy(void * f) { static_cast<F *>(f)->~F(); }
+                static const operations * table() {
+                    static const operations ops = { &call, &move, &destroy };
+                    return &ops;
+                }
+            };
+            template <typename F>
+            struct holder<F, false> {  // the place keeps a pointer to the functor
+                template <typename... G>
+                static void create(void * p, G &&... g) { *static_cast<F **>(p) = block<F>::create(std::forward<G>(g)...); }
+                static void call(void * f, int id) { (**static_cast<F **>(f))(id); }
+                static void move(void * from, void * to) { *static_cast<F **>(to) = *static_cast<F **>(from); }
+                static void destroy(void * f) { block<F>::destroy(*static_cast<F **>(f)); }
+                static const operations * table() {
+                    static const operations ops = { &call, &move, &destroy };
+                    return &ops;
+                }
+            };
+
+            storage_type storage;
+            const operations * ops;
+        };
+
+        // the boxes of the functors in the deques of work stealing, which need trivially copyable elements
+        // the thread that takes a functor out of its box keeps the box for its next push, so a thread that pushes to its own deque
+        // and pops from it does not allocate, a thief reuses the boxes it took for the functors it pushes
+        class task_boxes {
+        public:
+            static const int capacity = 256;  // more boxes are deleted
+
+            task_boxes() : n(0) {}
+            ~task_boxes() {
+                while (this->n > 0)
+                    delete this->boxes[--this->n];
+            }
+
+            task * box(task && t) {
+                if (this->n == 0)
+                    return new task(std::move(t));
+                task * b = this->boxes[--this->n];
+                *b = std::move(t);
+                return b;
+            }
+            void unbox(task * b, task & t) {
+                t = std::move(*b);
+                if (this->n < capacity)
+                    this->boxes[this->n++] = b;
+                else
+                    delete b;
+            }
+
+        private:
+            task_boxes(const task_boxes &);// = delete;
+            task_boxes & operator=(const task_boxes &);// = delete;
+
+            task * boxes[capacity];
+            int n;
+        };
+        inline task_boxes & this_boxes() {
+            static thread_local task_boxes b;
+            return b;
+        }
+
+        // the pool a task_group pushes to
+        struct executor {
+            void * pool;
+            void (*post)(void * pool, task && t);
+        };
+
+        static const int nBuckets = 40;  // of a histogram, bucket k counts the durations of [2^k, 2^(k+1)) ns, the last one also the longer
+
+        // the counters of one thread of the pool, written only by that thread, all of them are empty without _ctplThreadPoolStats_
+        // padded so the counters of different threads are not on one cache line
+        class worker_stats {
+        public:
+#if _ctplThreadPoolStats_
+            worker_stats() : last(now_ns()) {
+                for (auto c : { &this->nStarted, &this->nRun, &this->nSteals, &this->busyNs, &this->idleNs })
+                    c->store(0, std::memory_order_relaxed);
+                for (int k = 0; k < nBuckets; ++k) {
+                    this->waitNs[k].store(0, std::memory_order_relaxed);
+                    this->runNs[k].store(0, std::memory_order_relaxed);
+                }
+            }
+
+            void start(const task & t) {
+                std::int64_t now = now_ns();
+                add(this->idleNs, now - this->last);
+                add(this->waitNs[bucket(now - t.pushed)], 1);
+                add(this->nStarted, 1);
+                this->last = now;
+            }
+
+            void finish() {
+                std::int64_t now = now_ns();
+                add(this->busyNs, now - this->last);
+                add(this->runNs[bucket(now - this->last)], 1);
+                add(this->nRun, 1);
+                this->last = now;
+            }
+
+            void steal() { add(this->nSteals, 1); }
+
+            char before[64];
+            std::atomic<std::uint64_t> nStarted, nRun, nSteals, busyNs, idleNs;
+            std::atomic<std::uint64_t> waitNs[nBuckets];  // from the push to the start of the functors
+            std::atomic<std::uint64_t> runNs[nBuckets];
+
+        private:
+            // only this thread writes, so no read-modify-write is needed
+            static void add(std::atomic<std::uint64_t> & c, std::int64_t n) {
+                c.store(c.load(std::memory_order_relaxed) + static_cast<std::uint64_t>(n > 0 ? n : 0), std::memory_order_relaxed);
+            }
+
+            static int bucket(std::int64_t ns) {
+                int k = 0;
+                while (ns > 1 && k < nBuckets - 1) {
+                    ns >>= 1;
+                    ++k;
+                }
+                return k;
+            }
+
+            std::int64_t last;  // the time of the last start or finish
+            char after[64];
+#else
+            void start(const task &) {}
+            void finish() {}
+            void steal() {}
+#endif
+        };
+
+        // the times of the last functors run by one thread, in a ring written only by that thread and read by the others at any time
+        // a slot keeps the index of the functor, set to none while it is written, so a reader drops the slots written meanwhile
+        // empty without _ctplThreadPoolTrace_
+        class worker_trace {
+        public:
+#if _ctplThreadPoolTrace_
+            static const std::uint64_t size = _ctplThreadPoolTrace_;
+
+            struct event {
+                const char * tag;  // null for the functors pushed without one
+                std::int64_t pushed, started, finished;  // ns of the steady clock
+            };
+
+            worker_trace() : n(0) {
+                for (auto & slot : this->slots)
+                    slot.index.store(none, std::memory_order_relaxed);
+            }
+
+            std::int64_t start() const { return now_ns(); }
+
+            // the functor t started at the time started is finished now
+            void finish(const task & t, std::int64_t started) {
+                std::int64_t now = now_ns();
+                std::uint64_t k = this->n.load(std::memory_order_relaxed);
+                slot & s = this->slots[k % size];
+                s.index.store(none, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                s.tag.store(t.tag, std::memory_order_relaxed);
+                s.pushed.store(t.pushed, std::memory_order_relaxed);
+                s.started.store(started, std::memory_order_relaxed);
+                s.finished.store(now, std::memory_order_relaxed);
+                s.index.store(k, std::memory_order_release);
+                this->n.store(k + 1, std::memory_order_release);
+            }
+
+            // appends the events kept now to out, the oldest first
+            void read(std::vector<event> & out) const {
+                std::uint64_t end = this->n.load(std::memory_order_acquire);
+                for (std::uint64_t k = end > size ? end - size : 0; k < end; ++k) {
+                    const slot & s = this->slots[k % size];
+                    if (s.index.load(std::memory_order_acquire) != k)
+                        continue;
+                    event e = { s.tag.load(std::memory_order_relaxed), s.pushed.load(std::memory_order_relaxed),
+                                s.started.load(std::memory_order_relaxed), s.finished.load(std::memory_order_relaxed) };
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (s.index.load(std::memory_order_relaxed) == k)
+                        out.push_back(e);
+                }
+            }
+
+        private:
+            static const std::uint64_t none = ~std::uint64_t(0);
+
+            struct slot {
+                std::atomic<std::uint64_t> index;
+                std::atomic<const char *> tag;
+                std::atomic<std::int64_t> pushed, started, finished;
+            };
+
+            char before[64];
+            std::atomic<std::uint64_t> n;  // the functors recorded
+            slot slots[size];
+            char after[64];
+#else
+            int start() const { return 0; }
+            void finish(const task &, int) {}
+#endif
+        };
+
+        // the functors pushed to the pool and removed from the queue without being run
+        class queue_stats {
+        public:
+#if _ctplThreadPoolStats_
+            queue_stats() : nPushed(0), nRemoved(0) {}
+            void push(int n) { this->nPushed.fetch_add(n, std::memory_order_relaxed); }
+            void remove(int n) { this->nRemoved.fetch_add(n, std::memory_order_relaxed); }
+
+            char before[64];
+            std::atomic<std::uint64_t> nPushed;
+            std::atomic<std::uint64_t> nRemoved;
+            char after[64];
+#else
+            void push(int) {}
+            void remove(int) {}
+#endif
+        };
+
+        // if the queue policy Q has the batched pop
+        template <typename Q>
+        class has_batch_pop {
+            template <typename U>
+            static char test(decltype(std::declval<U &>().pop(static_cast<task *>(nullptr), 0, 0)) *);
+            template <typename U>
+            static long test(...);
+        public:
+            static const bool value = sizeof(test<Q>(nullptr)) == 1;
+        };
+
+        template <typename Q>
+        int pop_batch(Q & q, task * out, int n, int nShares, std::true_type) { return q.pop(out, n, nShares); }
+        template <typename Q>
+        int pop_batch(Q & q, task * out, int, int, std::false_type) { return q.pop(*out) ? 1 : 0; }
+
+        // the functors pushed to one thread of the pool, closed when the thread returns
+        class inbox {
+        public:
+            inbox() : isOpen(true), n(0) {}
+
+            // false if the inbox is closed, then t is not moved
+            bool push(task && t) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                if (!this->isOpen)
+                    return false;
+                this->q.push(std::move(t));
+                this->n.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            bool pop(task & t) {
+                if (this->n.load(std::memory_order_relaxed) == 0)  // the mutex is not touched if it is empty, see notify() of the pool
+                    return false;
+                std::unique_lock<std::mutex> lock(this->mutex);
+                if (this->q.empty())
+                    return false;
+                t = std::move(this->q.front());
+                this->q.pop();
+                this->n.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            // the functors left are moved to the end of left, returns how many
+            int close(std::vector<task> & left) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->isOpen = false;
+                int k = 0;
+                for (; !this->q.empty(); ++k) {
+                    left.push_back(std::move(this->q.front()));
+                    this->q.pop();
+                }
+                this->n.store(0, std::memory_order_relaxed);
+                return k;
+            }
+            int size() const { return this->n.load(std::memory_order_relaxed); }
+
+        private:
+            std::mutex mutex;
+            std::queue<task> q;
+            bool isOpen;
+            std::atomic<int> n;
+        };
+
+        // the functors pushed by one producer, see thread_pool::producer, in a ring of a power of 2 slots written only by the producer
+        // and read by one thread of the pool at a time, the one holding the lock, head and tail are on cache lines of their own
+        class staging {
+        public:
+            explicit staging(std::size_t size) : head(0), tail(0), isLocked(false) {
+                std::size_t n = 1;
+                while (n < size)
+                    n *= 2;
+                this->mask = n - 1;
+                this->slots.reset(new task[n]);
+            }
+
+            // by the producer, false if the ring is full, then t is not moved
+            bool push(task && t) {
+                std::size_t k = this->tail.load(std::memory_order_relaxed);
+                if (k - this->head.load(std::memory_order_acquire) > this->mask)
+                    return false;
+                this->slots[k & this->mask] = std::move(t);
+                this->tail.store(k + 1, std::memory_order_release);
+                return true;
+            }
+
+            bool empty() const { return this->head.load(std::memory_order_acquire) == this->tail.load(std::memory_order_acquire); }
+            std::size_t size() const { return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire); }
+
+            // taken by the thread that moves the functors out, so the ring keeps a single reader
+            bool try_lock() { return !this->isLocked.load(std::memory_order_relaxed) && !this->isLocked.exchange(true, std::memory_order_acquire); }
+            void lock() {
+                while (!this->try_lock())
+                    std::this_thread::yield();
+            }
+            void unlock() { this->isLocked.store(false, std::memory_order_release); }
+
+            // with the lock, moves up to n functors from the head by push(first, last), which returns the end of the moved ones,
+            // and frees their slots, returns how many were moved
+            template <typename Push>
+            std::size_t take(std::size_t n, Push push) {
+                std::size_t first = this->head.load(std::memory_order_relaxed);
+                std::size_t k = 0;
+                while (k < n) {
+                    std::size_t slot = (first + k) & this->mask;
+                    std::size_t m = std::min(n - k, this->mask + 1 - slot);  // up to the end of the ring
+                    task * begin = &this->slots[slot];
+                    std::size_t moved = static_cast<std::size_t>(push(begin, begin + m) - begin);
+                    k += moved;
+                    if (moved < m)
+                        break;
+                }
+                this->head.store(first + k, std::memory_order_release);
+                return k;
+            }
+
+        private:
+            char before[64];
+            std::atomic<std::size_t> head;  // of the pool
+            char padTail[64];
+            std::atomic<std::size_t> tail;  // of the producer
+            char padLock[64];
+            std::atomic<bool> isLocked;
+            std::size_t mask;
+            std::unique_ptr<task[]> slots;
+            char after[64];
+        };
+
+        // the functors a thread took from the queue at once and did not run yet, see thread_pool::set_batch()
+        // only its thread runs them, under a mutex since clear_queue() may delete them from another thread
+        class task_batch {
+        public:
+            task_batch() : next(0), n(0) {}
+
+            bool pop(task & t) {
+                if (this->n.load(std::memory_order_relaxed) == 0)  // the mutex is not touched if it is empty
+                    return false;
+                std::unique_lock<std::mutex> lock(this->mutex);
+                if (this->next >= this->tasks.size())
+                    return false;
+                t = std::move(this->tasks[this->next++]);
+                this->n.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            // takes the next functor of the batch, or if there is none, takes up to nMax functors by take(out, nMax), which returns
+            // how many it moved to out, keeps them as the batch and takes the first one, false if there was none
+            template <typename Take>
+            bool fill(task & t, int nMax, Take take) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                if (this->next < this->tasks.size()) {  // not run yet, they are not replaced
+                    t = std::move(this->tasks[this->next++]);
+                    this->n.fetch_sub(1, std::memory_order_relaxed);
+                    return true;
+                }
+                this->tasks.resize(nMax);
+                int k = take(this->tasks.data(), nMax);
+                this->tasks.resize(k);
+                if (k == 0)
+                    return false;
+                t = std::move(this->tasks[0]);
+                this->next = 1;
+                this->n.store(k - 1, std::memory_order_relaxed);
+                return true;
+            }
+            // deletes the functors left, returns how many
+            int clear() {
+                if (this->n.load(std::memory_order_relaxed) == 0)
+                    return 0;
+                std::unique_lock<std::mutex> lock(this->mutex);
+                int k = static_cast<int>(this->tasks.size() - std::min(this->next, this->tasks.size()));
+                this->tasks.clear();
+                this->next = 0;
+                this->n.store(0, std::memory_order_relaxed);
+                return k;
+            }
+            // the functors left are moved to the end of left
+            void close(std::vector<task> & left) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                for (; this->next < this->tasks.size(); ++this->next)
+                    left.push_back(std::move(this->tasks[this->next]));
+                this->tasks.clear();
+                this->next = 0;
+                this->n.store(0, std::memory_order_relaxed);
+            }
+
+        private:
+            std::mutex mutex;
+            std::vector<task> tasks;
+            std::size_t next;  // the first one not run yet
+            std::atomic<int> n;  // the ones not run yet
+        };
+
+        // the state of one thread of the pool, allocated together and padded so the states of two threads are not on one cache line
+        // the other threads only set the flag, steal from the deque, push to the inboxes and read the stats
+        struct worker_state {
+            worker_state() : flag(false), isFinished(false) {}
+
+            char before[64];
+            std::atomic<bool> flag;  // tells the thread to stop
+            std::atomic<bool> isFinished;  // set by the thread when it returns
+            char padDeque[64];
+            WorkStealingDeque<task *> deque;  // used if work stealing
+            worker_stats stats;
+            worker_trace trace;
+            char padInbox[64];
+            inbox pinned;  // of push_to(), only this thread runs them
+            inbox shared;  // of push_to() with affinity::preferred, the other threads may take them when idle
+            task_batch batch;
+            char after[64];
+        };
+
+        // the pool of the calling thread, set on the threads of a pool, so the wait for a future there can run the functors of the pool
+        // and the continuations of the futures made ready there are pushed to it
+        // run_one(pool) runs one functor of the pool, returns false if there is none, post(pool, t) pushes t to the pool
+        struct worker_hook {
+            void * pool;
+            bool (*run_one)(void * pool);
+            void (*post)(void * pool, task && t);
+            int id;  // of the thread in the pool
+        };
+        inline worker_hook & this_hook() {
+            static thread_local worker_hook h = { nullptr, nullptr, nullptr, -1 };
+            return h;
+        }
+
+        // whether a functor posted at a time has run or was cancelled, shared by the timer and the handle
+        class timer_state {
+        public:
+            timer_state() : state(pending) {}
+            // the functor of a one shot timer is run only if this returns true
+            bool start() { int expected = pending; return this->state.compare_exchange_strong(expected, started); }
+            bool cancel() { int expected = pending; return this->state.compare_exchange_strong(expected, cancelled); }
+            bool is_cancelled() const { return this->state.load(std::memory_order_acquire) == cancelled; }
+        private:
+            enum { pending, started, cancelled };
+            std::atomic<int> state;
+        };
+
+        // the functors waiting for their time, a min-heap under a mutex, the threads of the pool move the due ones to the queue
+        // one waiting thread at a time keeps the time, it waits until the earliest one is due, the others wait for pushes
+        class timer_queue {
+        public:
+            typedef std::chrono::steady_clock Clock;
+
+            timer_queue() : nextDue(never()), isKept(false), order(0) {}
+
+            // returns true if t is due before all the others, then a waiting thread must be woken up to keep the time
+            bool add(Clock::time_point due, task && t) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                entry e = { due, this->order++, std::move(t) };
+                this->heap.push_back(std::move(e));
+                std::push_heap(this->heap.begin(), this->heap.end(), later);
+                bool isFirst = this->heap.front().order == this->order - 1;
+                this->nextDue.store(this->heap.front().due.time_since_epoch().count(), std::memory_order_relaxed);
+                return isFirst;
+            }
+
+            // a load when there are no timers, otherwise also a read of the clock
+            bool is_due() const {
+                Clock::rep next = this->nextDue.load(std::memory_order_relaxed);
+                return next != never() && Clock::now().time_since_epoch().count() >= next;
+            }
+            bool is_pending() const { return this->nextDue.load(std::memory_order_relaxed) != never(); }
+
+            // moves the functors that are due to the end of due, in the order of their times
+            void take_due(std::vector<task> & due) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                Clock::time_point now = Clock::now();
+                while (!this->heap.empty() && this->heap.front().due <= now) {
+                    std::pop_heap(this->heap.begin(), this->heap.end(), later);
+                    due.push_back(std::move(this->heap.back().t));
+                    this->heap.pop_back();
+                }
+                this->nextDue.store(this->heap.empty() ? never() : this->heap.front().due.time_since_epoch().count(), std::memory_order_relaxed);
+            }
+
+            // the calling thread keeps the time until unkeep() if no other one does, due is the time to wake up
+            bool keep(Clock::time_point & due) {
+                Clock::rep next = this->nextDue.load(std::memory_order_relaxed);
+                if (next == never() || this->isKept.exchange(true, std::memory_order_relaxed))
+                    return false;
+                due = Clock::time_point(Clock::duration(next));
+                return true;
+            }
+            void unkeep() { this->isKept.store(false, std::memory_order_relaxed); }
+            bool is_kept() const { return this->isKept.load(std::memory_order_relaxed); }
+
+            // the functors are deleted without running them, returns how many
+            int clear() {
+                std::vector<entry> dropped;  // deleted after the mutex is unlocked, a deleted functor may add a timer
+                std::unique_lock<std::mutex> lock(this->mutex);
+                dropped.swap(this->heap);
+                this->nextDue.store(never(), std::memory_order_relaxed);
+                return static_cast<int>(dropped.size());
+            }
+
+        private:
+            struct entry {
+                Clock::time_point due;
+                std::uint64_t order;  // of the adds, the functors due at the same time are run in this order
+                task t;
+            };
+            static bool later(const entry & a, const entry & b) { return a.due > b.due || (a.due == b.due && a.order > b.order); }
+
+            static Clock::rep never() { return std::numeric_limits<Clock::rep>::max(); }
+
+            std::vector<entry> heap;
+            std::atomic<Clock::rep> nextDue;  // of the earliest functor, never() if there is none
+            std::atomic<bool> isKept;  // if a waiting thread keeps the time
+            std::uint64_t order;
+            std::mutex mutex;
+        };
+
+        // the result of a functor, a value, a reference or nothing
+        template <typename R>
+        class result {
+        public:
+            result() : isSet(false) {}
+            ~result() { if (this->isSet) reinterpret_cast<R *>(&this->storage)->~R(); }
+            template <typename F>
+            void set(F & f, int id) { new (&this->storage) R(f(id)); this->isSet = true; }
+            R get() { return std::move(*reinterpret_cast<R *>(&this->storage)); }
+        private:
+            typename std::aligned_storage<sizeof(R), std::alignment_of<R>::value>::type storage;
+            bool isSet;
+        };
+        template <typename R>
+        class result<R &> {
+        public:
+            template <typename F>
+            void set(F & f, int id) { this->p = &f(id); }
+            R & get() { return *this->p; }
+        private:
+            R * p;
+        };
+        template <>
+        class result<void> {
+        public:
+            template <typename F>
+            void set(F & f, int id) { f(id); }
+            void get() {}
+        };
+
+        // the state shared by a future and the functor that makes its result
+        template <typename R>
+        class shared_state {
+        public:
+            shared_state() : nRefs(2), isReady(false) {}  // one for the future, one for the functor
+            virtual ~shared_state() {}
+
+#if _ctplThreadPoolArena_
+            static void * operator new(std::size_t n) { return allocate_block(n); }
+            static void operator delete(void * p) { free_block(p); }
+            static void * operator new(std::size_t, void * p) { return p; }
+            static void operator delete(void *, void *) {}
+#endif
+
+            void retain() { this->nRefs.fetch_add(1, std::memory_order_relaxed); }
+            void release() {
+                if (this->nRefs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    delete this;
+            }
+
+            bool is_ready() const { return this->isReady.load(std::memory_order_acquire); }
+            void wait() {
+                if (this->is_ready() || this->help(std::chrono::steady_clock::time_point::max()))
+                    return;
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->cv.wait(lock, [this](){ return this->is_ready(); });
+            }
+            template <typename Clock, typename Duration>
+            bool wait_until(const std::chrono::time_point<Clock, Duration> & time) {
+                if (this->is_ready())
+                    return true;
+                if (this->help(time))
+                    return this->is_ready();
+                std::unique_lock<std::mutex> lock(this->mutex);
+                return this->cv.wait_until(lock, time, [this](){ return this->is_ready(); });
+            }
+
+            // call only once, when ready
+            R get() {
+                if (this->error)
+                    std::rethrow_exception(this->error);
+                return this->value.get();
+            }
+
+            // f is run with the id of the thread that makes the state ready, or -1 if it is ready already
+            // f may take over the reference of the caller, as promise_task does, there is one f per state
+            void on_ready(task && f) {
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    if (!this->isReady.load(std::memory_order_relaxed)) {
+                        this->then = std::move(f);
+                        return;
+                    }
+                }
+                f(-1);
+            }
+
+        protected:
+            template <typename F>
+            void run(F & f, int id) {
+                try {
+                    this->value.set(f, id);
+                }
+                catch (...) {
+                    this->error = std::current_exception();
+                }
+                this->set_ready(id);
+            }
+            // the functor is deleted without being run
+            void abandon() { this->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)), -1); }
+            void set_exception(std::exception_ptr e, int id) {
+                this->error = std::move(e);
+                this->set_ready(id);
+            }
+
+        private:
+            shared_state(const shared_state &);// = delete;
+            shared_state & operator=(const shared_state &);// = delete;
+
+            // a thread of a pool runs the functors of its pool until the state is ready or the time is up, so a functor waiting
+            // for another one does not block the thread, nor the pool when all its threads wait, returns false on the other threads at once
+            // when there is nothing to run it waits for the state a little longer each time, up to 1 ms, as a functor may be pushed meanwhile
+            // a timed wait may return late by the run time of the functor it runs
+            template <typename Clock, typename Duration>
+            bool help(const std::chrono::time_point<Clock, Duration> & time) {
+                worker_hook & h = this_hook();
+                if (!h.pool)
+                    return false;
+                int nMisses = 0;
+                while (!this->is_ready() && Clock::now() < time) {
+                    if (h.run_one(h.pool)) {
+                        nMisses = 0;
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->cv.wait_for(lock, std::chrono::microseconds(8 << std::min(nMisses++, 7)), [this](){ return this->is_ready(); });
+                }
+                return true;
+            }
+
+            void set_ready(int id) {
+                task f;
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->isReady.store(true, std::memory_order_release);
+                    f = std::move(this->then);
+                }
+                this->cv.notify_all();
+                if (f)
+                    f(id);
+            }
+
+            std::atomic<int> nRefs;
+            std::atomic<bool> isReady;
+            result<R> value;
+            std::exception_ptr error;
+            task then;
+            std::mutex mutex;
+            std::condition_variable cv;
+        };
+
+        // one allocation for the shared state and the functor
+        template <typename R, typename F>
+        class function_state : public shared_state<R> {
+        public:
+            template <typename... G>
+            function_state(G &&... g) : f(std::forward<G>(g)...) {}
+            void run(int id) { shared_state<R>::run(this->f, id); }
+            void abandon() { shared_state<R>::abandon(); }
+        private:
+            F f;
+        };
+
+        // the functor pushed to the queue for a function_state, breaks the promise if deleted without being run
+        template <typename R, typename F>
+        class packaged_task {
+        public:
+            packaged_task(function_state<R, F> * state) : state(state) {}
+            packaged_task(packaged_task && other) noexcept : state(other.state) { other.state = nullptr; }
+            ~packaged_task() {
+                if (this->state) {
+                    this->state->abandon();
+                    this->state->release();
+                }
+            }
+            void operator()(int id) {
+                function_state<R, F> * s = this->state;
+                if (!s)
+                    return;
+                this->state = nullptr;
+                s->run(id);
+                s->release();
+            }
+        private:
+            packaged_task(const packaged_task &);// = delete;
+            packaged_task & operator=(const packaged_task &);// = delete;
+            function_state<R, F> * state;
+        };
+
+        template <typename R>
+        struct promise_setter {
+            static void set(std::promise<R> & p, shared_state<R> & s) { p.set_value(s.get()); }
+        };
+        template <>
+        struct promise_setter<void> {
+            static void set(std::promise<void> & p, shared_state<void> & s) { s.get(); p.set_value(); }
+        };
+
+        // passes the result of a shared state to a std::promise
+        template <typename R>
+        class promise_task {
+        public:
+            promise_task(std::promise<R> && p, shared_state<R> * state) : p(std::move(p)), state(state) {}
+            promise_task(promise_task && other) noexcept : p(std::move(other.p)), state(other.state) { other.state = nullptr; }
+            ~promise_task() {
+                if (this->state)
+                    this->state->release();
+            }
+            void operator()(int) {
+                try {
+                    promise_setter<R>::set(this->p, *this->state);
+                }
+                catch (...) {
+                    this->p.set_exception(std::current_exception());
+                }
+            }
+        private:
+            promise_task(const promise_task &);// = delete;
+            promise_task & operator=(const promise_task &);// = delete;
+            std::promise<R> p;
+            shared_state<R> * state;
+        };
+
+        // calls f(id, k), for push_n()
+        template <typename F>
+        class indexed_call {
+        public:
+            template <typename G>
+            indexed_call(G && g, int k) : f(std::forward<G>(g)), k(k) {}
+            auto operator()(int id) -> decltype(std::declval<F &>()(id, 0)) { return this->f(id, this->k); }
+        private:
+            F f;
+            int k;
+        };
+
+        // std::index_sequence of c++14
+        template <std::size_t... I>
+        struct index_sequence {};
+        template <std::size_t N, std::size_t... I>
+        struct make_index_sequence : make_index_sequence<N - 1, N - 1, I...> {};
+        template <std::size_t... I>
+        struct make_index_sequence<0, I...> { typedef index_sequence<I...> type; };
+
+        // how an argument of push(f, args...) is kept, an std::reference_wrapper as the reference, the same as std::bind() does
+        template <typename T>
+        struct bound_arg { typedef T type; };
+        template <typename T>
+        struct bound_arg<std::reference_wrapper<T>> { typedef T & type; };
+
+        struct not_callable {};
+        template <typename R>
+        struct if_callable { typedef R type; };
+        template <>
+        struct if_callable<not_callable> {};
+
+        // the result of f(id, args...) with the args kept by value moved to f if f can take them so, otherwise passed as lvalues
+        // no type if f cannot be called either way, so the other overloads of push() are chosen
+        template <typename F, typename... Args>
+        struct bound_result {
+            template <typename G>
+            static auto moved(int) -> decltype(std::declval<G &>()(0, std::declval<Args>()...));
+            template <typename G>
+            static not_callable moved(...);
+            template <typename G>
+            static auto copied(int) -> decltype(std::declval<G &>()(0, std::declval<Args &>()...));
+            template <typename G>
+            static not_callable copied(...);
+
+            static const bool isMoved = !std::is_same<decltype(moved<F>(0)), not_callable>::value;
+            typedef typename std::conditional<isMoved, decltype(moved<F>(0)), decltype(copied<F>(0))>::type type;
+        };
+
+        // f and the arguments of push(f, args...) in place of std::bind(), each argument is moved once into the functor
+        // and then to f when it is called, so the arguments may be move only and a functor is called once
+        template <typename F, typename... Args>
+        class bound_call {
+        public:
+            typedef bound_result<F, Args...> result;
+
+            template <typename G, typename... As>
+            bound_call(G && g, As &&... as) : f(std::forward<G>(g)), args(std::forward<As>(as)...) {}
+
+            typename result::type operator()(int id) {
+                return this->call(id, typename make_index_sequence<sizeof...(Args)>::type(), std::integral_constant<bool, result::isMoved>());
+            }
+
+        private:
+            template <std::size_t... I>
+            typename result::type call(int id, index_sequence<I...>, std::true_type) { return this->f(id, std::get<I>(std::move(this->args))...); }
+            template <std::size_t... I>
+            typename result::type call(int id, index_sequence<I...>, std::false_type) { return this->f(id, std::get<I>(this->args)...); }
+
+            F f;
+            std::tuple<Args...> args;
+        };
+
+        // the functor made by push(f, args...) and its result, no type if f cannot be called with the args
+        template <typename F, typename... Rest>
+        struct bound : if_callable<typename bound_result<typename std::decay<F>::type, typename bound_arg<typename std::decay<Rest>::type>::type...>::type> {
+            typedef bound_call<typename std::decay<F>::type, typename bound_arg<typename std::decay<Rest>::type>::type...> call;
+        };
+
+        // the functor of a one shot timer, not run if the timer is cancelled
+        template <typename F>
+        class timed_call {
+        public:
+            template <typename... G>
+            timed_call(std::shared_ptr<timer_state> state, G &&... g) : state(std::move(state)), f(std::forward<G>(g)...) {}
+            void operator()(int id) {
+                if (this->state->start())
+                    this->f(id);
+            }
+        private:
+            std::shared_ptr<timer_state> state;
+            F f;
+        };
+
+        // a time of any clock as a time of the steady clock, the ones of the other clocks are converted as they are now
+        inline std::chrono::steady_clock::time_point steady_time(std::chrono::steady_clock::time_point t) { return t; }
+        template <typename Clock, typename Duration>
+        std::chrono::steady_clock::time_point steady_time(const std::chrono::time_point<Clock, Duration> & t) {
+            return std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(t - Clock::now());
+        }
+
+        // the length of the range if it can be known without going through it, otherwise 0
+        template <typename It>
+        std::size_t distance_hint(It first, It last, std::forward_iterator_tag) { return static_cast<std::size_t>(std::distance(first, last)); }
+        template <typename It>
+        std::size_t distance_hint(It, It, std::input_iterator_tag) { return 0; }
+    }
+
+    // how the functors are distributed among the threads of the pool
+    enum class schedule {
+        fifo,  // one queue shared by all the threads, the functors are run in the order they are pushed
+        work_stealing  // each thread has its own deque, the functors pushed from a thread of the pool go to the deque of that thread,
+                       // the thread runs them the last pushed first, idle threads steal from the other threads
+    };
+
+    // what an idle thread does before it waits for a notification: it spins pausing the cpu, then yields its time slice,
+    // and looks for a functor after each step
+    struct idle_policy {
+        int nSpins;
+        int nYields;
+        bool isParking;  // false to keep yielding instead of waiting, the thread never sleeps then
+        idle_policy(int nSpins = 0, int nYields = 0, bool isParking = true) : nSpins(nSpins), nYields(nYields), isParking(isParking) {}
+
+        // busy polls, a functor pushed to an idle pool starts at once, but each idle thread takes a whole core
+        static idle_policy latency() { return idle_policy(1 << 10, 0, false); }
+        // waits at once, an idle thread takes no cpu time, the default
+        static idle_policy efficiency() { return idle_policy(); }
+    };
+
+    // the idle policies, the second parameter of basic_thread_pool, tell the idle threads how long to spin and yield
+    // the default, the idle_policy set at run time with set_idle_policy()
+    class dynamic_idle {
+    public:
+        dynamic_idle() { this->set(idle_policy::efficiency()); }
+        // a thread that spins or yields follows the new policy at once, a waiting thread the next time it is idle
+        void set(const idle_policy & policy) {
+            this->nSpins.store(policy.nSpins, std::memory_order_relaxed);
+            this->nYields.store(policy.nYields, std::memory_order_relaxed);
+            this->isParking.store(policy.isParking, std::memory_order_relaxed);
+        }
+        idle_policy get() const { return idle_policy(this->spins(), this->yields(), this->parks()); }
+        int spins() const { return this->nSpins.load(std::memory_order_relaxed); }
+        int yields() const { return this->nYields.load(std::memory_order_relaxed); }
+        bool parks() const { return this->isParking.load(std::memory_order_relaxed); }
+    private:
+        std::atomic<int> nSpins;
+        std::atomic<int> nYields;
+        std::atomic<bool> isParking;
+    };
+
+    // an idle_policy fixed at compile time, so the idle loop of the threads is inlined, set_idle_policy() does not compile with it
+    template <int nSpins, int nYields = 0, bool isParking = true>
+    class fixed_idle {
+    public:
+        idle_policy get() const { return idle_policy(nSpins, nYields, isParking); }
+        int spins() const { return nSpins; }
+        int yields() const { return nYields; }
+        bool parks() const { return isParking; }
+    };
+
+    // what a push to a bounded pool does when the queue is full
+    enum class overflow {
+        block,  // waits until a thread of the pool takes a functor from the queue
+        caller_runs  // runs the functor on the calling thread, with id -1
+    };
+
+    // the lanes of the queue, the threads take the functors of a higher priority more often but not only them,
+    // so a functor of a lower priority is run even when the higher lanes are never empty
+    enum class priority {
+        high,
+        normal,  // the default, the only lane that has the functors pushed without a priority
+        low
+    };
+
+    // which threads may run a functor pushed to a thread with push_to()
+    enum class affinity {
+        strict,  // the default, only that thread
+        preferred  // the other threads too, when they have nothing else to do
+    };
+
+    // the name of the functors pushed with it in the trace, see thread_pool::write_trace()
+    // the name is not copied, it should live as long as the pool, a string literal for example
+    struct trace_tag {
+        explicit trace_tag(const char * name) : name(name) {}
+        const char * name;
+    };
+
+    // what thread_pool::drain() did
+    struct drain_result {
+        bool isDrained;  // if all the functors pushed before were finished in time
+        int nAbandoned;  // the functors and the timers deleted without running, their futures get the broken promise error
+    };
+
+    // where the threads of a pool run, the pinning is supported on linux and ignored elsewhere
+    struct placement {
+        std::vector<std::vector<int>> cpus;  // thread i is pinned to cpus[i % cpus.size()], the threads are not pinned if empty
+        bool isNodeQueues;  // one queue per numa node, a functor pushed from a cpu of a node goes to the queue of that node,
+                            // the threads of the node take from it first, then from the queues of the other nodes
+        placement() : isNodeQueues(false) {}
+
+        // each thread pinned to one cpu of the list, in turn
+        static placement pinned(const std::vector<int> & cpus) {
+            placement where;
+            for (int cpu : cpus)
+                where.cpus.push_back(std::vector<int>(1, cpu));
+            return where;
+        }
+
+        // the threads spread over the numa nodes in turn, each pinned to all the cpus of its node
+        static placement numa_spread(bool isNodeQueues = false) {
+            placement where;
+            where.cpus = detail::numa_nodes();
+            where.isNodeQueues = isNodeQueues;
+            return where;
+        }
+    };
+
+    // the bounds of a pool that changes its number of threads with the load, see basic_thread_pool::set_autoscale()
+    struct autoscale {
+        int minThreads;
+        int maxThreads;  // 0 to not scale, the default
+        std::chrono::milliseconds keepAlive;  // a thread that stays idle this long retires, down to minThreads
+        int queueDepth;  // threads are added when more functors than this stay in the queue with no thread idle ...
+        std::chrono::milliseconds sustain;  // ... for this long
+        autoscale(int minThreads = 0, int maxThreads = 0, std::chrono::milliseconds keepAlive = std::chrono::milliseconds(60000),
+                  int queueDepth = 0, std::chrono::milliseconds sustain = std::chrono::milliseconds(10)) :
+            minThreads(minThreads), maxThreads(maxThreads), keepAlive(keepAlive), queueDepth(queueDepth), sustain(sustain) {}
+    };
+
+#if _ctplThreadPoolStats_
+    // a snapshot of the counters of a pool, see thread_pool::stats()
+    struct pool_stats {
+        struct counters {
+            std::uint64_t nRun;  // functors finished
+            std::uint64_t nSteals;  // functors stolen from the other threads
+            std::uint64_t busyNs;  // the time spent running functors
+            std::uint64_t idleNs;  // the time spent looking for functors and waiting
+        };
+
+        static const int nBuckets = detail::nBuckets;  // bucket k counts the durations of [2^k, 2^(k+1)) ns, the last one also the longer
+
+        std::vector<counters> workers;  // of the current threads, in the order of their ids
+        counters total;  // of all the threads, also the ones removed by resize()
+        std::int64_t queueDepth;  // the functors pushed but not started yet
+        std::uint64_t waitNs[nBuckets];  // the time from the push to the start of the functors
+        std::uint64_t runNs[nBuckets];  // the run time of the functors
+
+        // the upper bound of the bucket holding the fraction q of the histogram, for example percentile(waitNs, 0.99)
+        static std::uint64_t percentile(const std::uint64_t (&buckets)[nBuckets], double q) {
+            std::uint64_t n = 0;
+            for (int k = 0; k < nBuckets; ++k)
+                n += buckets[k];
+            std::uint64_t sum = 0;
+            for (int k = 0; k < nBuckets; ++k) {
+                sum += buckets[k];
+                if (n > 0 && sum >= q * n)
+                    return std::uint64_t(2) << k;
+            }
+            return 0;
+        }
+    };
+#endif
+
+    // the queue policies, the first parameter of basic_thread_pool, keep the queued functors, a policy is a class with
+    //      explicit Queue(std::size_t size);  // size is the expected length, a hint that may be ignored
+    //      bool push(detail::task && t);  // false if t could not be queued, t is left as it was then
+    //      template <typename It> It push(It first, It last);  // moves the tasks of the range in, returns the end of the moved ones
+    //      bool pop(detail::task & t);  // false if the queue is empty
+    // and optionally, for thread_pool::set_batch()
+    //      int pop(detail::task * out, int n, int nShares);  // moves up to n tasks to out, but not more than 1 / nShares of the queue
+    // which may be called by many threads at once, the pool calls them directly, so they are inlined into the threads
+
+    // a std::queue under a mutex, the queue of ctpl_stl.h
+    class mutex_queue : public detail::Queue<detail::task> {
+    public:
+        explicit mutex_queue(std::size_t) {}
+    };
+
+    // a lock-free ring of nSlots, rounded up to a power of 2, that overflows to a queue under a mutex, see detail::RingQueue
+    template <std::size_t nSlots>
+    class ring_queue : public detail::RingQueue<detail::task> {
+    public:
+        explicit ring_queue(std::size_t) : detail::RingQueue<detail::task>(nSlots) {}
+    };
+
+    template <typename QueuePolicy, typename IdlePolicy = dynamic_idle>
+    class basic_thread_pool;
+
+    // the handle of a functor posted with post_at(), post_after() or post_every() of a pool, copies share the functor
+    class timer {
+    public:
+        timer() {}
+
+        // the functor is not run from now on, false if it has already started, was cancelled or there is none
+        // a periodic functor that is running finishes that run
+        // the functor is deleted when its time comes, or when the pool stops
+        bool cancel() { return this->state && this->state->cancel(); }
+        bool valid() const { return static_cast<bool>(this->state); }
+
+    private:
+        template <typename QueuePolicy, typename IdlePolicy>
+        friend class basic_thread_pool;
+
+        explicit timer(std::shared_ptr<detail::timer_state> state) : state(std::move(state)) {}
+
+        std::shared_ptr<detail::timer_state> state;
+    };
+
+    template <typename R>
+    class future;
+
+    namespace detail {
+        template <typename F, typename R>
+        class continuation;
+        template <typename R, typename F>
+        class continue_task;
+        struct access;
+    }
+
+    // the result of a functor pushed to the pool, used like std::future and converts to it
+    template <typename R>
+    class future {
+    public:
+        future() : state(nullptr) {}
+        future(future && other) noexcept : state(other.state) { other.state = nullptr; }
+        future & operator=(future && other) noexcept {
+            if (this != &other) {
+                if (this->state)
+                    this->state->release();
+                this->state = other.state;
+                other.state = nullptr;
+            }
+            return *this;
+        }
+        ~future() {
+            if (this->state)
+                this->state->release();
+        }
+
+        bool valid() const { return this->state != nullptr; }
+
+        // waits for the result and returns it or rethrows the exception of the functor, after that the future is not valid
+        // on a thread of a pool, the waits run the queued functors of that pool until the result is ready
+        R get() {
+            std::unique_ptr<detail::shared_state<R>, releaser> s(this->state);  // at return, release the state even if an exception is rethrown
+            this->state = nullptr;
+            s->wait();
+            return s->get();
+        }
+
+        void wait() const { this->state->wait(); }
+        template <typename Rep, typename Period>
+        std::future_status wait_for(const std::chrono::duration<Rep, Period> & duration) const {
+            return this->wait_until(std::chrono::steady_clock::now() + duration);
+        }
+        template <typename Clock, typename Duration>
+        std::future_status wait_until(const std::chrono::time_point<Clock, Duration> & time) const {
+            return this->state->wait_until(time) ? std::future_status::ready : std::future_status::timeout;
+        }
+
+        // runs f(id, future) with this future once it is ready and returns the future of f, after that this future is not valid
+        // f is pushed to the pool of the thread that makes this future ready, or run by that thread if it is not a thread of a pool;
+        // the pool that made this future is not kept, so the future and then() may outlive it: f is then run by the thread
+        // that makes the future ready, or by the caller of then() if the future is ready already
+        template <typename F>
+        auto then(F && f) ->future<decltype(f(0, std::declval<future>()))> {
+            typedef decltype(f(0, std::declval<future>())) T;
+            typedef detail::continuation<typename std::decay<F>::type, R> Function;
+            detail::shared_state<R> * s = this->state;
+            this->state = nullptr;
+            auto next = new detail::function_state<T, Function>(Function(std::forward<F>(f), future(s)));
+            future<T> result(next);
+            s->on_ready(detail::task(detail::continue_task<T, Function>(next)));
+            return result;
+        }
+
+        // the std::future gets the result when it is ready, after that this future is not valid
+        operator std::future<R>() && {
+            if (!this->state)
+                return std::future<R>();
+            std::promise<R> p;
+            std::future<R> f = p.get_future();
+            detail::shared_state<R> * s = this->state;
+            this->state = nullptr;
+            s->on_ready(detail::task(detail::promise_task<R>(std::move(p), s)));
+            return f;
+        }
+
+    private:
+        template <typename QueuePolicy, typename IdlePolicy>
+        friend class basic_thread_pool;
+        template <typename T>
+        friend class future;
+        friend struct detail::access;
+
+        future(const future &);// = delete;
+        future & operator=(const future &);// = delete;
+
+        struct releaser {
+            void operator()(detail::shared_state<R> * s) const { s->release(); }
+        };
+
+        explicit future(detail::shared_state<R> * state) : state(state) {}
+
+        detail::shared_state<R> * state;
+    };
+
+    // the result of when_any(), the index of a ready future and all the futures
+    template <typename Sequence>
+    struct when_any_result {
+        std::size_t index;
+        Sequence futures;
+    };
+
+    namespace detail {
+
+        // calls f(id, antecedent) with the ready future it continues, for future::then()
+        template <typename F, typename R>
+        class continuation {
+        public:
+            template <typename G>
+            continuation(G && g, future<R> && antecedent) : f(std::forward<G>(g)), antecedent(std::move(antecedent)) {}
+            continuation(continuation && other) : f(std::move(other.f)), antecedent(std::move(other.antecedent)) {}
+            auto operator()(int id) -> decltype(std::declval<F &>()(id, std::declval<future<R>>())) {
+                return this->f(id, std::move(this->antecedent));
+            }
+        private:
+            F f;
+            future<R> antecedent;
+        };
+
+        // pushes a continuation to the pool of the thread that makes the antecedent ready, which lives at least as long as
+        // that thread runs, or runs it at once on another thread
+        template <typename R, typename F>
+        class continue_task {
+        public:
+            continue_task(function_state<R, F> * state) : t(state) {}
+            continue_task(continue_task && other) noexcept : t(std::move(other.t)) {}
+            void operator()(int id) {
+                worker_hook & h = this_hook();
+                if (h.pool)
+                    h.post(h.pool, task(std::move(this->t)));
+                else
+                    this->t(id);
+            }
+        private:
+            packaged_task<R, F> t;
+        };
+
+        struct access {
+            template <typename R>
+            static shared_state<R> * state(future<R> & f) { return f.state; }
+            template <typename R>
+            static future<R> make(shared_state<R> * state) { return future<R>(state); }
+        };
+
+        // a state made ready by a combinator or a task graph instead of a functor, which keeps the reference of the functor
+        template <typename R>
+        class manual_state : public shared_state<R> {
+        public:
+            // makes the state ready with the result of f(id) or its exception
+            template <typename F>
+            void set(F & f, int id) { shared_state<R>::run(f, id); }
+            void abandon() { shared_state<R>::abandon(); }
+            void set_exception(std::exception_ptr e, int id) { shared_state<R>::set_exception(std::move(e), id); }
+        };
+
+        // tells a combinator that its input k is ready, holds a reference to the combinator
+        template <typename State>
+        class arrival {
+        public:
+            arrival(State * state, std::size_t k) : state(state), k(k) { state->retain(); }
+            arrival(arrival && other) noexcept : state(other.state), k(other.k) { other.state = nullptr; }
+            ~arrival() {
+                if (this->state)
+                    this->state->release();
+            }
+            void operator()(int id) { this->state->arrive(this->k, id); }
+        private:
+            arrival(const arrival &);// = delete;
+            arrival & operator=(const arrival &);// = delete;
+            State * state;
+            std::size_t k;
+        };
+
+        // ready with all the futures when the last of them is ready, for when_all()
+        template <typename Sequence>
+        class all_state : public manual_state<Sequence> {
+        public:
+            all_state(Sequence && futures, std::size_t n) : futures(std::move(futures)), nLeft(n + 1) {}  // one more for when_all() itself
+            void arrive(std::size_t, int id) {
+                if (this->nLeft.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                    return;
+                auto f = [this](int) { return std::move(this->futures); };
+                this->set(f, id);
+            }
+        private:
+            Sequence futures;
+            std::atomic<std::size_t> nLeft;
+        };
+
+        // ready with all the futures and the index of the first ready one, for when_any()
+        template <typename Sequence>
+        class any_state : public manual_state<when_any_result<Sequence>> {
+        public:
+            any_state(Sequence && futures) : futures(std::move(futures)), isDone(false) {}
+            void arrive(std::size_t k, int id) {
+                if (this->isDone.exchange(true, std::memory_order_acq_rel))
+                    return;
+                auto f = [this, k](int) {
+                    when_any_result<Sequence> r;
+                    r.index = k;
+                    r.futures = std::move(this->futures);
+                    return r;
+                };
+                this->set(f, id);
+            }
+        private:
+            Sequence futures;
+            std::atomic<bool> isDone;
+        };
+
+        // the states of the futures, taken before the futures are moved to a combinator that may pass them on at once,
+        // each one is retained until watch() is done with it
+        template <typename R>
+        shared_state<R> * retained(future<R> & f) {
+            shared_state<R> * s = access::state(f);
+            s->retain();
+            return s;
+        }
+
+        template <typename State, typename R>
+        void watch(State * combined, const std::vector<shared_state<R> *> & states) {
+            for (std::size_t k = 0; k < states.size(); ++k) {
+                states[k]->on_ready(task(arrival<State>(combined, k)));
+                states[k]->release();
+            }
+        }
+
+        template <std::size_t k, typename State, typename... States>
+        typename std::enable_if<(k == sizeof...(States))>::type watch(State *, const std::tuple<States...> &) {}
+        template <std::size_t k, typename State, typename... States>
+        typename std::enable_if<(k < sizeof...(States))>::type watch(State * combined, const std::tuple<States...> & states) {
+            std::get<k>(states)->on_ready(task(arrival<State>(combined, k)));
+            std::get<k>(states)->release();
+            watch<k + 1>(combined, states);
+        }
+
+        struct graph_node {
+            std::function<void(int)> f;
+            std::vector<std::size_t> successors;
+            std::size_t nPredecessors;
+        };
+
+        // one run of a task graph, shared by the functors of its nodes on the pool
+        template <typename Pool>
+        class graph_run : public std::enable_shared_from_this<graph_run<Pool>> {
+        public:
+            graph_run(Pool & pool, const std::shared_ptr<const std::vector<graph_node>> & nodes, manual_state<void> * done) :
+                pool(&pool), nodes(nodes), nLeft(nodes->size()), nPending(new std::atomic<std::size_t>[nodes->size()]),
+                isSkipped(new std::atomic<bool>[nodes->size()]), done(done) {
+                for (std::size_t k = 0; k < nodes->size(); ++k) {
+                    this->nPending[k].store((*nodes)[k].nPredecessors, std::memory_order_relaxed);
+                    this->isSkipped[k].store(false, std::memory_order_relaxed);
+                }
+            }
+            ~graph_run() {
+                if (this->done) {  // the functors were deleted without being run
+                    this->done->abandon();
+                    this->done->release();
+                }
+            }
+
+            void start() {
+                if (this->nodes->empty())
+                    return this->finish(-1);
+                for (std::size_t k = 0; k < this->nodes->size(); ++k) {
+                    if ((*this->nodes)[k].nPredecessors == 0)
+                        this->post(k);
+                }
+            }
+
+        private:
+            void post(std::size_t k) {
+                std::shared_ptr<graph_run> self(this->shared_from_this());
+                this->pool->post([self, k](int id) { self->run(k, id); });
+            }
+
+            // the successors of a node that threw are skipped, they pass it on without running
+            void run(std::size_t k, int id) {
+                const graph_node & node = (*this->nodes)[k];
+                bool isFailed = this->isSkipped[k].load(std::memory_order_relaxed);
+                if (!isFailed) {
+                    try {
+                        node.f(id);
+                    }
+                    catch (...) {
+                        std::unique_lock<std::mutex> lock(this->mutex);
+                        if (!this->error)
+                            this->error = std::current_exception();
+                        isFailed = true;
+                    }
+                }
+                for (std::size_t next : node.successors) {
+                    if (isFailed)
+                        this->isSkipped[next].store(true, std::memory_order_relaxed);
+                    if (this->nPending[next].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        this->post(next);
+                }
+                if (this->nLeft.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    this->finish(id);
+            }
+
+            void finish(int id) {
+                manual_state<void> * d = this->done;
+                this->done = nullptr;
+                if (this->error)
+                    d->set_exception(std::move(this->error), id);
+                else {
+                    auto f = [](int) {};
+                    d->set(f, id);
+                }
+                d->release();
+            }
+
+            Pool * pool;
+            std::shared_ptr<const std::vector<graph_node>> nodes;
+            std::atomic<std::size_t> nLeft;  // the nodes not finished yet
+            std::unique_ptr<std::atomic<std::size_t>[]> nPending;  // the predecessors of each node not finished yet
+            std::unique_ptr<std::atomic<bool>[]> isSkipped;
+            std::exception_ptr error;  // the first one
+            std::mutex mutex;
+            manual_state<void> * done;
+        };
+    }
+
+    // a future ready with all the futures of the range once they are all ready, nothing waits for them meanwhile
+    // the futures must be valid
+    template <typename It>
+    auto when_all(It first, It last) ->future<std::vector<typename std::iterator_traits<It>::value_type>> {
+        typedef std::vector<typename std::iterator_traits<It>::value_type> Sequence;
+        Sequence futures;
+        for (; first != last; ++first)
+            futures.push_back(std::move(*first));
+        std::vector<decltype(detail::access::state(futures[0]))> states;
+        for (auto & f : futures)
+            states.push_back(detail::retained(f));
+        auto combined = new detail::all_state<Sequence>(std::move(futures), states.size());
+        auto result = detail::access::make<Sequence>(combined);
+        detail::watch(combined, states);
+        combined->arrive(0, -1);
+        combined->release();
+        return result;
+    }
+
+    // the same for the futures of different types, ready with a tuple of them
+    template <typename... Rs>
+    future<std::tuple<future<Rs>...>> when_all(future<Rs> &&... futures) {
+        typedef std::tuple<future<Rs>...> Sequence;
+        std::tuple<detail::shared_state<Rs> *...> states(detail::retained(futures)...);
+        auto combined = new detail::all_state<Sequence>(Sequence(std::move(futures)...), sizeof...(Rs));
+        auto result = detail::access::make<Sequence>(combined);
+        detail::watch<0>(combined, states);
+        combined->arrive(0, -1);
+        combined->release();
+        return result;
+    }
+
+    // a future ready with all the futures of the range and the index of one that is ready, once any of them is ready
+    // ready at once with the index -1 if the range is empty
+    template <typename It>
+    auto when_any(It first, It last) ->future<when_any_result<std::vector<typename std::iterator_traits<It>::value_type>>> {
+        typedef std::vector<typename std::iterator_traits<It>::value_type> Sequence;
+        Sequence futures;
+        for (; first != last; ++first)
+            futures.push_back(std::move(*first));
+        std::vector<decltype(detail::access::state(futures[0]))> states;
+        for (auto & f : futures)
+            states.push_back(detail::retained(f));
+        auto combined = new detail::any_state<Sequence>(std::move(futures));
+        auto result = detail::access::make<when_any_result<Sequence>>(combined);
+        detail::watch(combined, states);
+        if (states.empty())
+            combined->arrive(static_cast<std::size_t>(-1), -1);
+        combined->release();
+        return result;
+    }
+
+    // functors run on a pool in the order of their dependencies, a node starts once the nodes before it are finished,
+    // nothing waits between them
+    //      ctpl::task_graph g;
+    //      auto a = g.add(load), b = g.add(parse), c = g.add(check), d = g.add(store);
+    //      g.precede(a, b); g.precede(a, c); g.precede(b, d); g.precede(c, d);
+    //      g.run(pool).get();
+    // the nodes after a node that throws are not run, the future of the run rethrows the first exception
+    class task_graph {
+    public:
+        typedef std::size_t node;
+
+        task_graph() : nodes(std::make_shared<std::vector<detail::graph_node>>()) {}
+
+        // f(int id) is copied by each run, so the graph may be run many times
+        template <typename F>
+        node add(F && f) {
+            detail::graph_node added;
+            added.f = std::forward<F>(f);
+            added.nPredecessors = 0;
+            this->edit().push_back(std::move(added));
+            return this->nodes->size() - 1;
+        }
+
+        // after starts once before is finished
+        void precede(node before, node after) {
+            std::vector<detail::graph_node> & all = this->edit();
+            all[before].successors.push_back(after);
+            ++all[after].nPredecessors;
+        }
+
+        std::size_t size() const { return this->nodes->size(); }
+
+        // pushes the nodes that do not depend on others to the pool, the future is ready when all the nodes are finished
+        // the graph may be changed or destroyed while it runs, the run keeps the nodes as they were
+        // throws std::invalid_argument if the graph has a cycle
+        template <typename Pool>
+        future<void> run(Pool & pool) const {
+            if (this->has_cycle())
+                throw std::invalid_argument("ctpl::task_graph has a cycle");
+            auto done = new detail::manual_state<void>();
+            future<void> result = detail::access::make<void>(done);
+            std::make_shared<detail::graph_run<Pool>>(pool, this->nodes, done)->start();
+            return result;
+        }
+
+    private:
+        // the nodes are copied if a run still has them
+        std::vector<detail::graph_node> & edit() {
+            if (this->nodes.use_count() > 1)
+                this->nodes = std::make_shared<std::vector<detail::graph_node>>(*this->nodes);
+            return *this->nodes;
+        }
+
+        bool has_cycle() const {
+            const std::vector<detail::graph_node> & all = *this->nodes;
+            std::vector<std::size_t> nPending(all.size());
+            std::vector<std::size_t> ready;
+            for (std::size_t k = 0; k < all.size(); ++k) {
+                nPending[k] = all[k].nPredecessors;
+                if (nPending[k] == 0)
+                    ready.push_back(k);
+            }
+            std::size_t nVisited = 0;
+            while (!ready.empty()) {
+                std::size_t k = ready.back();
+                ready.pop_back();
+                ++nVisited;
+                for (std::size_t next : all[k].successors) {
+                    if (--nPending[next] == 0)
+                        ready.push_back(next);
+                }
+            }
+            return nVisited != all.size();
+        }
+
+        std::shared_ptr<std::vector<detail::graph_node>> nodes;
+    };
+
+    namespace detail {
+
+        // the functors of a task_group not started yet, in a queue of the group, and the count of the ones not finished
+        // a functor pushed to the pool for each of them runs one of them, or nothing if they were run by wait() or cancelled meanwhile
+        class group_state {
+        public:
+            group_state() : queued(0), nLeft(0), isCancelled(false) {}
+
+            // false if the group is cancelled, then t is deleted
+            bool add(task && t) {
+                if (this->is_cancelled())
+                    return false;
+                this->nLeft.fetch_add(1, std::memory_order_relaxed);
+                this->queued.push(std::move(t));
+                return true;
+            }
+
+            // runs one functor of the group, false if there is none
+            bool run_one(int id) {
+                task t;
+                if (!this->queued.pop(t))
+                    return false;
+                if (!this->is_cancelled()) {
+                    try {
+                        t(id);
+                    }
+                    catch (...) {
+                        std::unique_lock<std::mutex> lock(this->mutex);
+                        if (!this->error)
+                            this->error = std::current_exception();
+                    }
+                }
+                t.reset();  // before it is counted as finished, the group may be gone then
+                this->finish(1);
+                return true;
+            }
+
+            // the queued functors are deleted, the running ones finish
+            void cancel() {
+                this->isCancelled.store(true, std::memory_order_release);
+                int n = 0;
+                task t;
+                while (this->queued.pop(t)) {
+                    t.reset();
+                    ++n;
+                }
+                this->finish(n);
+            }
+            bool is_cancelled() const { return this->isCancelled.load(std::memory_order_acquire); }
+
+            // runs the functors of the group and, on a thread of a pool, the functors of that pool until all of the group are finished
+            // when there is nothing to run, a thread of a pool waits a little longer each time, as a functor may be pushed meanwhile
+            void wait() {
+                worker_hook & h = this_hook();
+                int nMisses = 0;
+                while (this->nLeft.load(std::memory_order_acquire) > 0) {
+                    if (this->run_one(h.pool ? h.id : -1) || (h.pool && h.run_one(h.pool))) {
+                        nMisses = 0;
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    auto isDone = [this](){ return this->nLeft.load(std::memory_order_acquire) == 0; };
+                    if (h.pool)
+                        this->cv.wait_for(lock, std::chrono::microseconds(8 << std::min(nMisses++, 7)), isDone);
+                    else
+                        this->cv.wait(lock, isDone);
+                }
+            }
+
+            std::exception_ptr take_error() {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                std::exception_ptr e;
+                std::swap(e, this->error);
+                return e;
+            }
+
+        private:
+            void finish(int n) {
+                if (n == 0 || this->nLeft.fetch_sub(n, std::memory_order_acq_rel) != n)
+                    return;
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->cv.notify_all();
+            }
+
+            mutex_queue queued;
+            std::atomic<int> nLeft;  // the functors added and not finished or deleted yet
+            std::atomic<bool> isCancelled;
+            std::exception_ptr error;  // the first one thrown by a functor of the group
+            std::mutex mutex;
+            std::condition_variable cv;
+        };
+
+        template <typename Pool>
+        void post_to(void * pool, task && t) { static_cast<Pool *>(pool)->post(std::move(t)); }
+
+    }
+
+    // functors run on a pool and waited for together, without a future for each of them
+    //      ctpl::task_group g(pool);
+    //      for (auto & part : parts)
+    //          g.run([&part](int id){ process(part); });
+    //      g.wait();  // rethrows the first exception
+    // cancel() deletes the functors of the group not started yet, the other functors of the pool are not touched
+    class task_group {
+    public:
+        template <typename Pool>
+        explicit task_group(Pool & pool) : state(std::make_shared<detail::group_state>()) {
+            this->where.pool = &pool;
+            this->where.post = &detail::post_to<Pool>;
+        }
+
+        // waits for the functors of the group, an exception that wait() did not rethrow is dropped
+        ~task_group() { this->state->wait(); }
+
+        // runs f(id, rest...) on a thread of the pool, the returned value is dropped, nothing is run once the group is cancelled
+        // the arguments are kept as by push()
+        template <typename F, typename... Rest>
+        void run(F && f, Rest&&... rest) {
+            typedef typename detail::bound<F, Rest...>::call Function;
+            this->add(detail::task(detail::emplace<Function>(), std::forward<F>(f), std::forward<Rest>(rest)...));
+        }
+
+        template <typename F>
+        void run(F && f) {
+            this->add(detail::task(std::forward<F>(f)));
+        }
+
+        // waits until all the functors of the group are finished, the calling thread runs the ones not started yet meanwhile,
+        // a thread of a pool also the functors of its pool; rethrows the first exception thrown by a functor of the group
+        // more functors may be run after the wait, also by the functors of the group while the group waits
+        void wait() {
+            this->state->wait();
+            std::exception_ptr e = this->state->take_error();
+            if (e)
+                std::rethrow_exception(e);
+        }
+
+        // the functors of the group not started yet are deleted and no more are run, the running ones finish,
+        // they may look at is_cancelled() to finish early; may be called from any thread, also from a functor of the group
+        void cancel() { this->state->cancel(); }
+        bool is_cancelled() const { return this->state->is_cancelled(); }
+
+    private:
+        task_group(const task_group &);// = delete;
+        task_group & operator=(const task_group &);// = delete;
+
+        void add(detail::task && t) {
+            if (!this->state->add(std::move(t)))
+                return;
+            std::shared_ptr<detail::group_state> s(this->state);
+            this->where.post(this->where.pool, detail::task([s](int id) { s->run_one(id); }));
+        }
+
+        detail::executor where;
+        std::shared_ptr<detail::group_state> state;
+    };
+
+#if _ctplThreadPoolCoroutines_
+    template <typename T = void>
+    class task;
+
+    namespace detail {
+
+        // resumes the coroutine awaiting a task when the task is done
+        class task_promise_base {
+        public:
+            struct final_awaiter {
+                bool await_ready() noexcept { return false; }
+                template <typename P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+                    std::coroutine_handle<> next = h.promise().continuation;
+                    return next ? next : std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            final_awaiter final_suspend() noexcept { return {}; }
+            void unhandled_exception() { this->error = std::current_exception(); }
+
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+        };
+
+        template <typename T>
+        class task_promise : public task_promise_base {
+        public:
+            ctpl::task<T> get_return_object();
+            template <typename V>
+            void return_value(V && v) { this->value.emplace(std::forward<V>(v)); }
+            T get() {
+                if (this->error)
+                    std::rethrow_exception(this->error);
+                return std::move(*this->value);
+            }
+        private:
+            std::optional<T> value;
+        };
+        template <>
+        class task_promise<void> : public task_promise_base {
+        public:
+            ctpl::task<void> get_return_object();
+            void return_void() {}
+            void get() {
+                if (this->error)
+                    std::rethrow_exception(this->error);
+            }
+        };
+
+        // a coroutine that starts at once and destroys itself at the end, for basic_thread_pool::spawn()
+        struct detached {
+            struct promise_type {
+                detached get_return_object() noexcept { return {}; }
+                std::suspend_never initial_suspend() noexcept { return {}; }
+                std::suspend_never final_suspend() noexcept { return {}; }
+                void return_void() noexcept {}
+                void unhandled_exception() noexcept {}  // drive() gives the exceptions to its state, the state_guard breaks the promise otherwise
+            };
+        };
+
+        // where a coroutine waiting in co_await pool.schedule() is, shared by the awaiter and the resumer, in the frame
+        struct schedule_point {
+            enum { suspending, posted, dropped, resumed };
+            std::atomic<int> phase;
+            bool isBroken;  // the resumer was deleted without being run, co_await throws
+        };
+
+        // the functor that resumes a coroutine on a thread of the pool, only the handle and the point are stored, in place
+        // a resumer deleted without being run, by stop() or clear_queue(), destroys the frame of a coroutine that owns itself,
+        // as drive() does, and resumes any other coroutine, whose co_await pool.schedule() then throws the broken promise error
+        // while await_suspend() posts the resumer, a resumer run or deleted meanwhile leaves the coroutine to await_suspend()
+        class resumer {
+        public:
+            resumer(std::coroutine_handle<> h, schedule_point * point, bool isOwner) : h(h), point(point), isOwner(isOwner) {}
+            resumer(resumer && other) noexcept : h(std::exchange(other.h, nullptr)), point(other.point), isOwner(other.isOwner) {}
+            ~resumer() {
+                if (!this->h || this->point->phase.exchange(schedule_point::dropped, std::memory_order_acq_rel) == schedule_point::suspending)
+                    return;
+                if (this->isOwner)
+                    this->h.destroy();
+                else {
+                    this->point->isBroken = true;
+                    this->h.resume();
+                }
+            }
+            void operator()(int) {
+                std::coroutine_handle<> k = std::exchange(this->h, nullptr);
+                if (this->point->phase.exchange(schedule_point::resumed, std::memory_order_acq_rel) != schedule_point::suspending)
+                    k.resume();
+            }
+        private:
+            resumer(const resumer &);// = delete;
+            resumer & operator=(const resumer &);// = delete;
+            std::coroutine_handle<> h;
+            schedule_point * point;
+            bool isOwner;  // the coroutine destroys itself at the end, nothing else owns the frame
+        };
+
+        template <typename Pool>
+        class schedule_awaiter {
+        public:
+            explicit schedule_awaiter(Pool & pool) : pool(&pool) { this->point.isBroken = false; }
+            bool await_ready() const noexcept { return false; }
+            // the frame is not touched once the resumer may run on another thread, so the exchange is the last access,
+            // a resumer run or deleted while it is posted, e.g. on a closed pool, leaves the coroutine to be resumed here
+            template <typename P>
+            bool await_suspend(std::coroutine_handle<P> h) {
+                this->point.phase.store(schedule_point::suspending, std::memory_order_relaxed);
+                this->pool->post(resumer(h, &this->point, std::is_same<P, detached::promise_type>::value));
+                int phase = this->point.phase.exchange(schedule_point::posted, std::memory_order_acq_rel);
+                if (phase == schedule_point::suspending)
+                    return true;
+                this->point.isBroken = phase == schedule_point::dropped;
+                return false;
+            }
+            void await_resume() const {
+                if (this->point.isBroken)
+                    throw std::future_error(std::future_errc::broken_promise);
+            }
+        private:
+            Pool * pool;
+            schedule_point point;
+        };
+
+        // the state of spawn(), released with the frame of drive(), with the broken promise error if drive() did not make it ready
+        template <typename T>
+        class state_guard {
+        public:
+            explicit state_guard(manual_state<T> * state) : state(state), isSet(false) {}
+            ~state_guard() {
+                if (!this->isSet)
+                    this->state->abandon();
+                this->state->release();
+            }
+            manual_state<T> * state;
+            bool isSet;
+        private:
+            state_guard(const state_guard &);// = delete;
+            state_guard & operator=(const state_guard &);// = delete;
+        };
+
+        // moves to the pool, runs the task and gives its result or exception to the state
+        // the error of a post to the pool goes to the state too, a frame destroyed before the end breaks the promise
+        template <typename Pool, typename T>
+        detached drive(Pool & pool, ctpl::task<T> t, manual_state<T> * state) {
+            state_guard<T> guard(state);
+            try {
+                co_await pool.schedule();
+                if constexpr (std::is_void<T>::value) {
+                    co_await t;
+                    auto f = [](int) {};
+                    guard.isSet = true;
+                    state->set(f, -1);
+                }
+                else {
+                    T value = co_await t;
+                    auto f = [&value](int) -> T { return std::move(value); };
+                    guard.isSet = true;
+                    state->set(f, -1);
+                }
+            }
+            catch (...) {
+                if (!guard.isSet) {
+                    guard.isSet = true;
+                    state->set_exception(std::current_exception(), -1);
+                }
+            }
+        }
+    }
+
+    // a coroutine that starts when it is awaited or spawned on a pool, co_await gives its result or rethrows its exception
+    // the awaiting coroutine is resumed by the thread that finishes the task, without a push to the pool
+    //      ctpl::task<int> read_and_sum(ctpl::thread_pool & pool) {
+    //          std::string s = co_await read_file();  // on the i/o thread
+    //          co_await pool.schedule();  // on a thread of the pool from here on
+    //          co_return sum(s);
+    //      }
+    //      int n = pool.spawn(read_and_sum(pool)).get();
+    template <typename T>
+    class task {
+    public:
+        typedef detail::task_promise<T> promise_type;
+
+        task(task && other) noexcept : h(std::exchange(other.h, nullptr)) {}
+        task & operator=(task && other) noexcept {
+            if (this != &other) {
+                if (this->h)
+                    this->h.destroy();
+                this->h = std::exchange(other.h, nullptr);
+            }
+            return *this;
+        }
+        ~task() {
+            if (this->h)
+                this->h.destroy();
+        }
+
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            this->h.promise().continuation = awaiting;
+            return this->h;
+        }
+        T await_resume() { return this->h.promise().get(); }
+
+    private:
+        friend class detail::task_promise<T>;
+
+        task(const task &);// = delete;
+        task & operator=(const task &);// = delete;
+
+        explicit task(std::coroutine_handle<promise_type> h) : h(h) {}
+
+        std::coroutine_handle<promise_type> h;
+    };
+
+    namespace detail {
+        template <typename T>
+        ctpl::task<T> task_promise<T>::get_return_object() { return ctpl::task<T>(std::coroutine_handle<task_promise>::from_promise(*this)); }
+        inline ctpl::task<void> task_promise<void>::get_return_object() {
+            return ctpl::task<void>(std::coroutine_handle<task_promise>::from_promise(*this));
+        }
+    }
+#endif
+
+    // the pool of threads running the functors of the queue chosen by QueuePolicy, idle as IdlePolicy says
+    // queueSize is passed to the queue policy
+    template <typename QueuePolicy, typename IdlePolicy>
+    class basic_thread_pool {
+
+    public:
+
+        basic_thread_pool() : q(_ctplThreadPoolLength_), qHigh(0), qLow(0) { this->init(ctpl::schedule::fifo); }
+        basic_thread_pool(int nThreads, int queueSize) : q(queueSize), qHigh(0), qLow(0) { this->init(ctpl::schedule::fifo); this->resize(nThreads); }
+        basic_thread_pool(int nThreads, ctpl::schedule mode = ctpl::schedule::fifo, int queueSize = _ctplThreadPoolLength_) : q(queueSize), qHigh(0), qLow(0) {
+            this->init(mode); this->resize(nThreads);
+        }
+        basic_thread_pool(int nThreads, const placement & where, ctpl::schedule mode = ctpl::schedule::fifo, int queueSize = _ctplThreadPoolLength_) :
+            q(queueSize), qHigh(0), qLow(0) {
+            this->init(mode); this->set_placement(where); this->resize(nThreads);
+        }
+
+        // the destructor waits for all the functions in the queue to be finished
+        ~basic_thread_pool() {
+            this->stop(true);
+        }
+
+        // get the number of running threads in the pool
+        int size() { return this->nThreads.load(std::memory_order_relaxed); }
+
+        // number of idle threads
+        int n_idle() { return this->nWaiting + this->nSpinning; }
+        // should not be called while the pool is resized, by resize() or by the scaling thread
+        std::thread & get_thread(int i) { return *this->threads[i]; }
+
+        // change what the idle threads do before they wait, may be called at any time, only with dynamic_idle
+        // a thread that spins or yields follows the new policy at once, a waiting thread the next time it is idle
+        void set_idle_policy(const idle_policy & policy) { this->idlePolicy.set(policy); }
+
+        idle_policy get_idle_policy() const { return this->idlePolicy.get(); }
+
+#if _ctplThreadPoolStats_
+        // a snapshot of the counters, each of them is read atomically but not all of them at once
+        // should not be called at the same time as resize() or stop()
+        pool_stats stats() const {
+            pool_stats snapshot = pool_stats();
+            std::vector<const detail::worker_stats *> all;
+            for (auto & worker : this->workers) {
+                const detail::worker_stats * w = &worker->stats;
+                pool_stats::counters c = { w->nRun.load(std::memory_order_relaxed), w->nSteals.load(std::memory_order_relaxed),
+                                           w->busyNs.load(std::memory_order_relaxed), w->idleNs.load(std::memory_order_relaxed) };
+                snapshot.workers.push_back(c);
+                all.push_back(w);
+            }
+            for (auto & w : this->retiredStats)
+                all.push_back(w.get());
+            std::uint64_t nStarted = 0;
+            for (auto w : all) {
+                snapshot.total.nRun += w->nRun.load(std::memory_order_relaxed);
+                snapshot.total.nSteals += w->nSteals.load(std::memory_order_relaxed);
+                snapshot.total.busyNs += w->busyNs.load(std::memory_order_relaxed);
+                snapshot.total.idleNs += w->idleNs.load(std::memory_order_relaxed);
+                nStarted += w->nStarted.load(std::memory_order_relaxed);
+                for (int k = 0; k < pool_stats::nBuckets; ++k) {
+                    snapshot.waitNs[k] += w->waitNs[k].load(std::memory_order_relaxed);
+                    snapshot.runNs[k] += w->runNs[k].load(std::memory_order_relaxed);
+                }
+            }
+            snapshot.queueDepth = static_cast<std::int64_t>(this->queueStats.nPushed.load(std::memory_order_relaxed) -
+                                                            this->queueStats.nRemoved.load(std::memory_order_relaxed) - nStarted);
+            return snapshot;
+        }
+#endif
+
+#if _ctplThreadPoolTrace_
+        // writes the functors kept in the traces of the threads as the json of the chrome trace, for chrome://tracing or perfetto:
+        // one complete event for each run, on the track of the id of the thread, named by the tag of the push,
+        // with the time of the push and the wait from there to the start in the args, the times are in us of the steady clock
+        // each thread keeps only its last _ctplThreadPoolTrace_ functors, the ones written over meanwhile are left out
+        // should not be called at the same time as resize() or stop()
+        void write_trace(std::ostream & out) const {
+            std::vector<std::pair<int, const detail::worker_trace *>> traces;
+            for (auto & r : this->retiredTraces)
+                traces.push_back(std::make_pair(r.first, r.second.get()));
+            for (int i = 0; i < static_cast<int>(this->workers.size()); ++i)
+                traces.push_back(std::make_pair(i, &this->workers[i]->trace));
+            auto us = [&out](std::int64_t ns) {
+                if (ns < 0) {
+                    out << '-';
+                    ns = -ns;
+                }
+                char fraction[4] = { char('0' + ns / 100 % 10), char('0' + ns / 10 % 10), char('0' + ns % 10), 0 };
+                out << ns / 1000 << '.' << fraction;
+            };
+            out << "{\"traceEvents\":[";
+            bool isFirst = true;
+            std::vector<bool> isNamed;
+            std::vector<detail::worker_trace::event> events;
+            for (auto & trace : traces) {
+                if (isNamed.size() <= static_cast<std::size_t>(trace.first))
+                    isNamed.resize(trace.first + 1, false);
+                if (!isNamed[trace.first]) {
+                    out << (isFirst ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << trace.first
+                        << ",\"args\":{\"name\":\"thread " << trace.first << "\"}}";
+                    isNamed[trace.first] = true;
+                    isFirst = false;
+                }
+                events.clear();
+                trace.second->read(events);
+                for (auto & e : events) {
+                    out << (isFirst ? "" : ",") << "\n{\"name\":\"";
+                    for (const char * c = e.tag ? e.tag : "job"; *c; ++c) {
+                        unsigned char u = static_cast<unsigned char>(*c);
+                        if (*c == '"' || *c == '\\')
+                            out << '\\' << *c;
+                        else if (u < 0x20)
+                            out << "\\u00" << "0123456789abcdef"[u >> 4] << "0123456789abcdef"[u & 15];
+                        else
+                            out << *c;
+                    }
+                    out << "\",\"cat\":\"ctpl\",\"ph\":\"X\",\"pid\":0,\"tid\":" << trace.first << ",\"ts\":";
+                    us(e.started);
+                    out << ",\"dur\":";
+                    us(e.finished - e.started);
+                    out << ",\"args\":{\"pushed\":";
+                    us(e.pushed);
+                    out << ",\"wait\":";
+                    us(e.started - e.pushed);
+                    out << "}}";
+                    isFirst = false;
+                }
+            }
+            out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+        }
+#endif
+
+        // pin the threads started from now on and set up the queues of the numa nodes as where says
+        // should be called before any thread is started or anything is pushed, the constructor with a placement does so
+        void set_placement(const placement & where) {
+            this->where = where;
+            this->nodeQueues.clear();
+            this->nodeOfCpu.clear();
+            if (!where.isNodeQueues)
+                return;
+            std::vector<std::vector<int>> nodes = detail::numa_nodes();
+            for (int node = 0; node < static_cast<int>(nodes.size()); ++node) {
+                this->nodeQueues.emplace_back(new NodeQueue(_ctplThreadPoolLength_));
+                for (int cpu : nodes[node]) {
+                    if (cpu >= static_cast<int>(this->nodeOfCpu.size()))
+                        this->nodeOfCpu.resize(cpu + 1, -1);
+                    this->nodeOfCpu[cpu] = node;
+                }
+            }
+        }
+
+        // change the number of threads in the pool
+        // may be called from any thread at the same time as stop() or set_autoscale(), the calls take turns
+        // the removed threads finish the functor they run and return, they are joined by a later resize() or by stop()
+        // nThreads must be >= 0
+        void resize(int nThreads) {
+            std::unique_lock<std::mutex> lock(this->resizeMutex);
+            this->resize_threads(nThreads);
+        }
+
+        // let the pool add threads up to bounds.maxThreads while the functors stay in the queue and retire the threads
+        // that stay idle down to bounds.minThreads, the size is first put within the bounds
+        // one more thread looks at the load a few times per keepAlive and sustain, bounds.maxThreads == 0 stops it
+        // resize() may still be called, the scaling goes on from the new size
+        // should be called before pushing, the functors already in the queue are not counted
+        void set_autoscale(const autoscale & bounds) {
+            std::unique_ptr<std::thread> old;
+            {
+                std::unique_lock<std::mutex> lock(this->resizeMutex);
+                old = this->take_scaler();
+                if (bounds.maxThreads <= 0 || this->isStop || this->isDone)
+                    this->isScaling = false;
+                else {
+                    int minThreads = std::max(0, std::min(bounds.minThreads, bounds.maxThreads));
+                    this->resize_threads(std::min(std::max(this->size(), minThreads), bounds.maxThreads));
+                    if (!this->isScaling)
+                        this->nUnstarted = 0;
+                    this->isScaling = true;
+                    std::shared_ptr<std::atomic<bool>> flag = std::make_shared<std::atomic<bool>>(false);
+                    this->scalerFlag = flag;
+                    this->scaler.reset(new std::thread([this, bounds, flag](){ this->scale(bounds, *flag); }));
+                }
+            }
+            if (old)
+                old->join();
+        }
+
+        // empty the queue, returns how many functors were deleted
+        int clear_queue() {
+            int n = 0;
+            detail::task t;
+            while (this->q.pop(t) || this->qHigh.pop(t) || this->qLow.pop(t) || this->pop_nodes(t)) {
+                t.reset(); // empty the queue
+                ++n;
+            }
+            for (auto & w : this->workers) {
+                while (w->pinned.pop(t) || this->pop_shared(*w, t)) {
+                    t.reset();
+                    ++n;
+                }
+                n += w->batch.clear();
+                detail::task * _f;
+                while (!w->deque.empty()) {
+                    if (w->deque.steal(_f)) {
+                        unbox(_f, t);
+                        t.reset();
+                        ++n;
+                    }
+                }
+            }
+            int nStaged = 0;  // not counted by wait_idle()
+            std::shared_ptr<const Producers> ps = std::atomic_load(&this->producers);
+            for (auto & ring : *ps) {
+                std::unique_lock<detail::staging> lock(*ring);
+                nStaged += static_cast<int>(ring->take(ring->size(), [](detail::task * first, detail::task * last) {
+                    for (detail::task * k = first; k != last; ++k)
+                        k->reset();
+                    return last;
+                }));
+            }
+            this->release(n + nStaged);
+            this->queueStats.remove(n + nStaged);
+            this->finish(n);
+            return n + nStaged;
+        }
+
+        // pops a functional wrapper to the original function
+        std::function<void(int)> pop() {
+            detail::task t;
+            if (!this->qHigh.pop(t) && !this->pop_nodes(t) && !this->q.pop(t) && !this->qLow.pop(t)) {
+                detail::task * _f;
+                for (auto & w : this->workers) {
+                    if (w->deque.steal(_f)) {
+                        unbox(_f, t);
+                        break;
+                    }
+                }
+            }
+            std::function<void(int)> f;
+            if (t) {
+                this->release(1);
+                this->queueStats.remove(1);
+                this->finish(1);  // not counted by wait_idle() any more
+                std::shared_ptr<detail::task> func(new detail::task(std::move(t)));  // std::function needs a copyable functor
+                f = [func](int id) { (*func)(id); };
+            }
+            return f;
+        }
+
+        // wait for all computing threads to finish and stop all threads
+        // may be called asynchronously to not pause the calling thread while waiting
+        // if isWait == true, all the functions in the queue are run, otherwise the queue is cleared without running the functions
+        void stop(bool isWait = false) { this->halt(isWait); }
+
+        // waits until all the functors pushed before and meanwhile are finished, the threads stay for the next ones
+        // the timers not due yet are not waited for; must not be called from a functor of the pool, it would wait for itself
+        void wait_idle() { this->wait_idle_until(std::chrono::steady_clock::time_point::max()); }
+
+        // the same as wait_idle(), but waits up to timeout, returns false if the pool was still busy then
+        template<typename Rep, typename Period>
+        bool wait_idle(const std::chrono::duration<Rep, Period> & timeout) {
+            return this->wait_idle_until(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+        }
+
+        // stops taking functors pushed from outside the pool, these are deleted at once, waits up to timeout for the ones pushed before
+        // and for what they push, then stops the threads as stop() does: the functors not started yet and the timers are deleted
+        // and counted; the running functors cannot be interrupted, so they are still waited for
+        // must not be called from a functor of the pool
+        template<typename Rep, typename Period>
+        drain_result drain(const std::chrono::duration<Rep, Period> & timeout) {
+            auto until = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+            this->isClosed.store(true, std::memory_order_relaxed);
+            drain_result result;
+            result.isDrained = this->wait_idle_until(until);
+            result.nAbandoned = this->halt(false);
+            return result;
+        }
+
+        // the arguments are moved to the functor, or copied if they are lvalues, and moved from there to f if it takes them so,
+        // std::ref() and std::cref() pass a reference
+        template<typename F, typename... Rest>
+        auto push(F && f, Rest&&... rest) ->future<typename detail::bound<F, Rest...>::type> {
+            return this->push(priority::normal, std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        // run the user's function that excepts argument int - id of the running thread. returned value is templatized
+        // operator returns ctpl::future, where the user can get the result and rethrow the catched exceptins, it converts to std::future
+        // the functor and the shared state of the future are allocated together, once
+        template<typename F>
+        auto push(F && f) ->future<decltype(f(0))> {
+            return this->push(priority::normal, std::forward<F>(f));
+        }
+
+        // the same as push(), to the lane of the priority
+        template<typename F, typename... Rest>
+        auto push(priority p, F && f, Rest&&... rest) ->future<typename detail::bound<F, Rest...>::type> {
+            typedef typename detail::bound<F, Rest...>::type R;
+            return this->template push_state<R, typename detail::bound<F, Rest...>::call>(p, std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        template<typename F>
+        auto push(priority p, F && f) ->future<decltype(f(0))> {
+            return this->template push_state<decltype(f(0)), typename std::decay<F>::type>(p, std::forward<F>(f));
+        }
+
+        // the same as push(), with the name of the functor in the trace, see write_trace(), the tag is dropped without _ctplThreadPoolTrace_
+        template<typename F, typename... Rest>
+        auto push(trace_tag tag, F && f, Rest&&... rest) ->future<typename detail::bound<F, Rest...>::type> {
+            detail::trace_scope scope(tag.name);
+            return this->push(priority::normal, std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        template<typename F>
+        auto push(trace_tag tag, F && f) ->future<decltype(f(0))> {
+            detail::trace_scope scope(tag.name);
+            return this->push(priority::normal, std::forward<F>(f));
+        }
+
+        // run the user's functions from the range [first, last), each with the signature ret func(int id)
+        // all the functions are put to the queue at once and the waiting threads are woken up once
+        // returns the futures in the order of the range
+        template<typename It>
+        auto push_bulk(It first, It last) ->std::vector<future<decltype((*first)(0))>> {
+            typedef decltype((*first)(0)) R;
+            typedef typename std::decay<decltype(*first)>::type Function;
+            std::size_t n = detail::distance_hint(first, last, typename std::iterator_traits<It>::iterator_category());
+            std::vector<future<R>> results;
+            std::vector<detail::task> tasks;
+            results.reserve(n);
+            tasks.reserve(n);
+            for (; first != last; ++first) {
+                auto state = this->template make_state<R, Function>(*first);
+                results.push_back(future<R>(state));
+                tasks.push_back(detail::task(detail::packaged_task<R, Function>(state)));
+            }
+            this->push_tasks(tasks);
+            return results;
+        }
+
+        // run f(id, k) for k = 0, ..., n - 1, the same way as push_bulk()
+        template<typename F>
+        auto push_n(int n, F && f) ->std::vector<future<decltype(f(0, 0))>> {
+            typedef decltype(f(0, 0)) R;
+            typedef detail::indexed_call<typename std::decay<F>::type> Function;
+            std::vector<future<R>> results;
+            std::vector<detail::task> tasks;
+            results.reserve(n > 0 ? n : 0);
+            tasks.reserve(n > 0 ? n : 0);
+            for (int k = 0; k < n; ++k) {
+                auto state = this->template make_state<R, Function>(Function(f, k));
+                results.push_back(future<R>(state));
+                tasks.push_back(detail::task(detail::packaged_task<R, Function>(state)));
+            }
+            this->push_tasks(tasks);
+            return results;
+        }
+
+        // run the user's function without a future, the returned value is dropped
+        // an exception thrown by the function goes to the error handler
+        template<typename F, typename... Rest>
+        void post(F && f, Rest&&... rest) {
+            this->post(priority::normal, std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        template<typename F>
+        void post(F && f) {
+            this->push_task(detail::task(std::forward<F>(f)));
+        }
+
+        // the same as post(), with the name of the functor in the trace, as push(tag, f) has
+        template<typename F, typename... Rest>
+        void post(trace_tag tag, F && f, Rest&&... rest) {
+            detail::trace_scope scope(tag.name);
+            this->post(priority::normal, std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        template<typename F>
+        void post(trace_tag tag, F && f) {
+            detail::trace_scope scope(tag.name);
+            this->push_task(detail::task(std::forward<F>(f)));
+        }
+
+        // the same as post(), to the lane of the priority
+        template<typename F, typename... Rest>
+        void post(priority p, F && f, Rest&&... rest) {
+            typedef typename detail::bound<F, Rest...>::call Function;
+            this->push_task(detail::task(detail::emplace<Function>(), std::forward<F>(f), std::forward<Rest>(rest)...), p);
+        }
+
+        template<typename F>
+        void post(priority p, F && f) {
+            this->push_task(detail::task(std::forward<F>(f)), p);
+        }
+
+        // run the user's function at the time due, the same as push() then
+        // the due functors are moved to the queue by the threads of the pool when they look for work, and by the waiting thread
+        // that keeps the time, so a pool without threads or with all of them busy runs them late
+        // the functors not due when the pool stops are deleted without running, their futures get the broken promise error
+        template<typename Clock, typename Duration, typename F, typename... Rest>
+        auto push_at(const std::chrono::time_point<Clock, Duration> & due, F && f, Rest&&... rest) ->future<typename detail::bound<F, Rest...>::type> {
+            typedef typename detail::bound<F, Rest...>::type R;
+            return this->template timed_state<R, typename detail::bound<F, Rest...>::call>(detail::steady_time(due), std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        template<typename Clock, typename Duration, typename F>
+        auto push_at(const std::chrono::time_point<Clock, Duration> & due, F && f) ->future<decltype(f(0))> {
+            return this->template timed_state<decltype(f(0)), typename std::decay<F>::type>(detail::steady_time(due), std::forward<F>(f));
+        }
+
+        // the same as push_at(), after the delay
+        template<typename Rep, typename Period, typename F, typename... Rest>
+        auto push_after(const std::chrono::duration<Rep, Period> & delay, F && f, Rest&&... rest) ->future<typename detail::bound<F, Rest...>::type> {
+            return this->push_at(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay),
+                                 std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        // run the user's function at the time due without a future, the same as post() then
+        // the returned timer cancels it
+        template<typename Clock, typename Duration, typename F, typename... Rest>
+        timer post_at(const std::chrono::time_point<Clock, Duration> & due, F && f, Rest&&... rest) {
+            typedef detail::timed_call<typename detail::bound<F, Rest...>::call> Function;
+            std::shared_ptr<detail::timer_state> state = std::make_shared<detail::timer_state>();
+            this->add_timer(detail::steady_time(due), detail::task(detail::emplace<Function>(), state, std::forward<F>(f), std::forward<Rest>(rest)...));
+            return timer(state);
+        }
+
+        template<typename Clock, typename Duration, typename F>
+        timer post_at(const std::chrono::time_point<Clock, Duration> & due, F && f) {
+            std::shared_ptr<detail::timer_state> state = std::make_shared<detail::timer_state>();
+            this->add_timer(detail::steady_time(due), detail::task(detail::timed_call<typename std::decay<F>::type>(state, std::forward<F>(f))));
+            return timer(state);
+        }
+
+        // the same as post_at(), after the delay
+        template<typename Rep, typename Period, typename F, typename... Rest>
+        timer post_after(const std::chrono::duration<Rep, Period> & delay, F && f, Rest&&... rest) {
+            return this->post_at(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay),
+                                 std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        // run the user's function every period, the first time one period from now, until the returned timer is cancelled
+        // the next time is counted from the previous one, a run is never started before the previous one has finished,
+        // the times missed meanwhile are skipped; period must be > 0
+        // the arguments are kept by std::bind() and passed as lvalues, since the function is called more than once
+        template<typename Rep, typename Period, typename F, typename... Rest>
+        timer post_every(const std::chrono::duration<Rep, Period> & period, F && f, Rest&&... rest) {
+            return this->post_every(period, std::bind(std::forward<F>(f), std::placeholders::_1, std::forward<Rest>(rest)...));
+        }
+
+        template<typename Rep, typename Period, typename F>
+        timer post_every(const std::chrono::duration<Rep, Period> & period, F && f) {
+            typedef typename std::decay<F>::type Function;
+            std::shared_ptr<periodic<Function>> r(new periodic<Function>(std::forward<F>(f)));
+            r->state = std::make_shared<detail::timer_state>();
+            r->period = std::max(std::chrono::steady_clock::duration(1), std::chrono::duration_cast<std::chrono::steady_clock::duration>(period));
+            r->due = std::chrono::steady_clock::now() + r->period;
+            this->add_periodic(r);
+            return timer(r->state);
+        }
+
+#if _ctplThreadPoolCoroutines_
+        // co_await pool.schedule() resumes the coroutine on a thread of the pool, it throws the broken promise error
+        // if the pool deletes the functor resuming it, by stop() or clear_queue(), or if the pool is closed by drain()
+        detail::schedule_awaiter<basic_thread_pool> schedule() { return detail::schedule_awaiter<basic_thread_pool>(*this); }
+
+        // runs the task on a thread of the pool, the future gets its result or exception, the broken promise error
+        // if the pool deletes the functor starting the task
+        template <typename T>
+        future<T> spawn(task<T> t) {
+            auto state = new detail::manual_state<T>();
+            future<T> result(state);
+            detail::drive(*this, std::move(t), state);
+            return result;
+        }
+#endif
+
+        // the most functors a thread takes from the queue at once, 1 by default, so it does not touch the queue for each small functor
+        // a thread takes no more than its share of the functors in the queue, so a short queue is still spread over the threads
+        // the functors taken are run by that thread only, in order, before anything else, clear_queue() deletes them as well;
+        // only if the queue policy has the batched pop
+        void set_batch(int n) { this->batchSize.store(std::max(1, n), std::memory_order_relaxed); }
+
+        int get_batch() const { return this->batchSize.load(std::memory_order_relaxed); }
+
+        // limit the number of the functors waiting in the queue, 0 for no limit, the default
+        // when the queue is full, push(), post(), push_bulk() and push_n() wait or run the functor on the calling thread as mode says,
+        // a thread of the pool does not wait but runs the functor, so the pool cannot block on itself
+        // should be called before pushing, the functors already in the queue are not counted
+        void set_capacity(int capacity, overflow mode = overflow::block) {
+            this->isCallerRuns.store(mode == overflow::caller_runs, std::memory_order_relaxed);
+            this->capacity.store(capacity > 0 ? capacity : 0, std::memory_order_relaxed);
+        }
+
+        int get_capacity() const { return this->capacity.load(std::memory_order_relaxed); }
+
+        // push the functor only if there is room in the queue, otherwise nothing is run and the returned future is not valid
+        template<typename F, typename... Rest>
+        auto try_push(F && f, Rest&&... rest) ->future<typename detail::bound<F, Rest...>::type> {
+            typedef typename detail::bound<F, Rest...>::type R;
+            return this->template push_until<R, typename detail::bound<F, Rest...>::call>(std::chrono::steady_clock::time_point::min(),
+                                                                                            std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        template<typename F>
+        auto try_push(F && f) ->future<decltype(f(0))> {
+            return this->template push_until<decltype(f(0)), typename std::decay<F>::type>(std::chrono::steady_clock::time_point::min(), std::forward<F>(f));
+        }
+
+        // the same as try_push(), but waits up to timeout for room in the queue
+        template<typename Rep, typename Period, typename F, typename... Rest>
+        auto try_push_for(const std::chrono::duration<Rep, Period> & timeout, F && f, Rest&&... rest) ->future<typename detail::bound<F, Rest...>::type> {
+            typedef typename detail::bound<F, Rest...>::type R;
+            auto until = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+            return this->template push_until<R, typename detail::bound<F, Rest...>::call>(until, std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        template<typename Rep, typename Period, typename F>
+        auto try_push_for(const std::chrono::duration<Rep, Period> & timeout, F && f) ->future<decltype(f(0))> {
+            auto until = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+            return this->template push_until<decltype(f(0)), typename std::decay<F>::type>(until, std::forward<F>(f));
+        }
+
+        // run the user's function on the thread id of the pool, otherwise the same as push(); throws std::out_of_range unless 0 <= id < size()
+        // a thread runs the functors pushed to it before the others, in the order they were pushed, so the state kept by id stays there
+        // if the thread is removed by resize() before, another thread runs them; they are counted in a bounded queue but never wait for room
+        template<typename F, typename... Rest>
+        auto push_to(int id, F && f, Rest&&... rest) ->future<typename detail::bound<F, Rest...>::type> {
+            return this->push_to(affinity::strict, id, std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        template<typename F>
+        auto push_to(int id, F && f) ->future<decltype(f(0))> {
+            return this->push_to(affinity::strict, id, std::forward<F>(f));
+        }
+
+        // the same as push_to(), with affinity::preferred an idle thread takes the functor when the thread id has not started it yet
+        template<typename F, typename... Rest>
+        auto push_to(affinity a, int id, F && f, Rest&&... rest) ->future<typename detail::bound<F, Rest...>::type> {
+            typedef typename detail::bound<F, Rest...>::type R;
+            return this->template inbox_state<R, typename detail::bound<F, Rest...>::call>(a, &id, &id + 1, std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        template<typename F>
+        auto push_to(affinity a, int id, F && f) ->future<decltype(f(0))> {
+            return this->template inbox_state<decltype(f(0)), typename std::decay<F>::type>(a, &id, &id + 1, std::forward<F>(f));
+        }
+
+        // the same as push_to(), to the thread of the group with the fewest functors pushed to it and not started yet
+        // throws std::invalid_argument if the group is empty
+        template<typename F, typename... Rest>
+        auto push_to_group(const std::vector<int> & group, F && f, Rest&&... rest) ->future<typename detail::bound<F, Rest...>::type> {
+            return this->push_to_group(affinity::strict, group, std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        template<typename F>
+        auto push_to_group(const std::vector<int> & group, F && f) ->future<decltype(f(0))> {
+            return this->push_to_group(affinity::strict, group, std::forward<F>(f));
+        }
+
+        template<typename F, typename... Rest>
+        auto push_to_group(affinity a, const std::vector<int> & group, F && f, Rest&&... rest) ->future<typename detail::bound<F, Rest...>::type> {
+            typedef typename detail::bound<F, Rest...>::type R;
+            return this->template inbox_state<R, typename detail::bound<F, Rest...>::call>(a, group.data(), group.data() + group.size(),
+                                                                                            std::forward<F>(f), std::forward<Rest>(rest)...);
+        }
+
+        template<typename F>
+        auto push_to_group(affinity a, const std::vector<int> & group, F && f) ->future<decltype(f(0))> {
+            return this->template inbox_state<decltype(f(0)), typename std::decay<F>::type>(a, group.data(), group.data() + group.size(), std::forward<F>(f));
+        }
+
+        // a handle of an outside thread that pushes many functors, see make_producer()
+        // push() and post() put the functors to a ring of the handle instead of the queue, so the producers do not take the lock
+        // of the queue or write its shared counters, the threads of the pool move the functors from the rings to the queue in batches
+        // when they look for work, and every 16th time they pop anything, so the rings are not left behind a queue that is never empty
+        // only one thread may push through a handle at a time, a full ring or a bounded queue make push() go the usual way
+        // the functors pushed through one handle start in the order of their pushes, with the others in no particular order
+        // the handle should not outlive the pool, the functors still in the ring are moved to the queue when it is destroyed
+        class producer {
+        public:
+            producer() : pool(nullptr) {}
+            producer(producer && other) : pool(other.pool), ring(std::move(other.ring)) { other.pool = nullptr; }
+            producer & operator=(producer && other) {
+                if (this != &other) {
+                    this->reset();
+                    this->pool = other.pool;
+                    this->ring = std::move(other.ring);
+                    other.pool = nullptr;
+                }
+                return *this;
+            }
+            ~producer() { this->reset(); }
+
+            explicit operator bool() const { return this->pool != nullptr; }
+
+            // the same as thread_pool::push()
+            template<typename F, typename... Rest>
+            auto push(F && f, Rest&&... rest) ->future<typename detail::bound<F, Rest...>::type> {
+                typedef typename detail::bound<F, Rest...>::type R;
+                return this->template stage_state<R, typename detail::bound<F, Rest...>::call>(std::forward<F>(f), std::forward<Rest>(rest)...);
+            }
+
+            template<typename F>
+            auto push(F && f) ->future<decltype(f(0))> {
+                return this->template stage_state<decltype(f(0)), typename std::decay<F>::type>(std::forward<F>(f));
+            }
+
+            // the same as thread_pool::post()
+            template<typename F, typename... Rest>
+            void post(F && f, Rest&&... rest) {
+                typedef typename detail::bound<F, Rest...>::call Function;
+                this->pool->stage(*this->ring, detail::task(detail::emplace<Function>(), std::forward<F>(f), std::forward<Rest>(rest)...));
+            }
+
+            template<typename F>
+            void post(F && f) {
+                this->pool->stage(*this->ring, detail::task(std::forward<F>(f)));
+            }
+
+            // moves the functors still in the ring to the queue and detaches the handle from the pool
+            void reset() {
+                if (!this->pool)
+                    return;
+                this->pool->remove_producer(this->ring);
+                this->pool = nullptr;
+                this->ring.reset();
+            }
+
+        private:
+            friend class basic_thread_pool;
+            producer(basic_thread_pool & pool, std::shared_ptr<detail::staging> ring) : pool(&pool), ring(std::move(ring)) {}
+
+            producer(const producer &);// = delete;
+            producer & operator=(const producer &);// = delete;
+
+            template <typename R, typename Function, typename... Args>
+            future<R> stage_state(Args &&... args) {
+                auto state = this->pool->template make_state<R, Function>(std::forward<Args>(args)...);
+                future<R> result(state);
+                this->pool->stage(*this->ring, detail::task(detail::packaged_task<R, Function>(state)));
+                return result;
+            }
+
+            basic_thread_pool * pool;
+            std::shared_ptr<detail::staging> ring;
+        };
+
+        // a handle with a ring of size functors, rounded up to a power of 2, for an outside thread that pushes many of them
+        producer make_producer(std::size_t size = 256) {
+            auto ring = std::make_shared<detail::staging>(std::max<std::size_t>(1, size));
+            {
+                std::unique_lock<std::mutex> lock(this->producersMutex);
+                auto ps = std::make_shared<Producers>(*this->producers);
+                ps->push_back(ring);
+                std::atomic_store(&this->producers, std::shared_ptr<const Producers>(ps));
+                this->producersVersion.fetch_add(1, std::memory_order_release);
+                this->nProducers.fetch_add(1, std::memory_order_relaxed);
+            }
+            return producer(*this, ring);
+        }
+
+        // the handler is called by the thread with its id and the exception thrown by a function pushed with post()
+        // without a handler the exceptions are dropped
+        void set_error_handler(std::function<void(int id, std::exception_ptr e)> handler) {
+            std::unique_lock<std::mutex> lock(this->errorMutex);
+            this->errorHandler = std::move(handler);
+        }
+
+
+    private:
+
+        typedef detail::WorkStealingDeque<detail::task *> Deque;  // the functors are boxed since the deque needs trivially copyable elements, see detail::task_boxes
+        typedef std::vector<std::shared_ptr<Deque>> Deques;
+        typedef std::vector<std::shared_ptr<detail::worker_state>> Workers;
+        typedef QueuePolicy NodeQueue;
+        typedef std::vector<std::shared_ptr<detail::staging>> Producers;
+
+        // a thread removed by resize(), joined once it has returned
+        struct retiree {
+            std::unique_ptr<std::thread> thread;
+            std::shared_ptr<detail::worker_state> worker;  // its isFinished is set when the thread returns
+        };
+
+        // the thread of this pool that runs the calling code, if any
+        struct this_worker {
+            basic_thread_pool * pool;
+            Deque * deque;
+            unsigned turn;  // of the lanes
+            int node;  // the numa node of the thread if the pool has the node queues, otherwise -1
+            detail::worker_stats * stats;
+            int id;
+            detail::worker_state * state;
+            unsigned nPops;  // every 16th pop looks at the rings of the producers
+            int producersVersion;  // of the copy of producers
+            std::shared_ptr<const Producers> producers;
+        };
+        static this_worker & current() {
+            static thread_local this_worker w = { nullptr, nullptr, 0, -1, nullptr, -1, nullptr, 0, -1, nullptr };
+            return w;
+        }
+
+        // deleted
+        basic_thread_pool(const basic_thread_pool &);// = delete;
+        basic_thread_pool(basic_thread_pool &&);// = delete;
+        basic_thread_pool & operator=(const basic_thread_pool &);// = delete;
+        basic_thread_pool & operator=(basic_thread_pool &&);// = delete;
+
+        // the state of the future of a functor, the functor is made in place from args
+        template <typename R, typename Function, typename... Args>
+        detail::function_state<R, Function> * make_state(Args &&... args) {
+            return new detail::function_state<R, Function>(std::forward<Args>(args)...);
+        }
+
+        // a functor of post_every(), added to the timers again after each run
+        template <typename F>
+        struct periodic {
+            template <typename G>
+            explicit periodic(G && g) : f(std::forward<G>(g)) {}
+            F f;
+            std::shared_ptr<detail::timer_state> state;
+            std::chrono::steady_clock::duration period;
+            std::chrono::steady_clock::time_point due;
+        };
+
+        template <typename F>
+        void add_periodic(const std::shared_ptr<periodic<F>> & r) {
+            this->add_timer(r->due, detail::task([this, r](int id) {
+                if (r->state->is_cancelled())
+                    return;
+                try {
+                    r->f(id);
+                }
+                catch (...) {  // to the error handler, like post()
+                    this->repeat(r);
+                    throw;
+                }
+                this->repeat(r);
+            }));
+        }
+
+        template <typename F>
+        void repeat(const std::shared_ptr<periodic<F>> & r) {
+            if (r->state->is_cancelled())
+                return;
+            r->due = std::max(r->due + r->period, std::chrono::steady_clock::now());
+            this->add_periodic(r);
+        }
+
+        // the functor goes to the queue at the time due, nothing is added once the pool stops
+        void add_timer(std::chrono::steady_clock::time_point due, detail::task && t) {
+            if (this->isStop || this->isDone || this->is_closed())
+                return;
+            if (!this->timers.add(due, std::move(t)))
+                return;
+            // the earliest timer changed, the thread keeping the time waits for the one before, any waiting thread keeps it if none does
+            std::unique_lock<std::mutex> lock(this->mutex);
+            if (this->timers.is_kept())
+                this->cv.notify_all();
+            else
+                this->cv.notify_one();
+        }
+
+        // moves the due timers to the queue
+        void fire_timers() {
+            std::vector<detail::task> due;
+            this->timers.take_due(due);
+            if (!due.empty())
+                this->push_tasks(due);
+        }
+
+        // waits for a push, or until the earliest timer is due if no other waiting thread keeps the time, returns true then
+        bool wait(std::unique_lock<std::mutex> & lock) {
+            std::chrono::steady_clock::time_point due;
+            if (!this->timers.keep(due)) {
+                this->cv.wait(lock);
+                return false;
+            }
+            this->cv.wait_until(lock, due);
+            this->timers.unkeep();
+            return true;
+        }
+
+        static void post_task(void * pool, detail::task && t) {
+            static_cast<basic_thread_pool *>(pool)->push_task(std::move(t));
+        }
+
+        // a functor pushed from a thread of this pool goes to the deque of that thread if work stealing
+        void push_task(detail::task && t, priority p = priority::normal) {
+            if (this->is_closed())
+                return t.reset();  // its future gets the broken promise error
+            if (this->admit(1) == 0)
+                return this->run_here(std::move(t));
+            this->enqueue(std::move(t), p);
+            this->notify(1);
+        }
+
+        // stop() returning how many functors it deleted
+        int halt(bool isWait) {
+            int nDeleted = 0;
+            std::unique_ptr<std::thread> scaler;
+            std::vector<retiree> retirees;
+            {
+                // once the flags are set, resize() does nothing, so the threads are joined without the lock
+                std::unique_lock<std::mutex> lock(this->resizeMutex);
+                if (!isWait) {
+                    if (this->isStop)
+                        return 0;
+                    this->isStop = true;
+                    for (auto & w : this->workers)
+                        w->flag = true;  // command the threads to stop
+                    nDeleted += this->clear_queue();  // empty the queue
+                }
+                else {
+                    if (this->isDone || this->isStop)
+                        return 0;
+                    this->isDone = true;  // give the waiting threads a command to finish
+                }
+                scaler = this->take_scaler();
+                retirees.swap(this->retirees);
+            }
+            if (scaler)
+                scaler->join();
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->cv.notify_all();  // stop all waiting threads
+            }
+            {
+                std::unique_lock<std::mutex> lock(this->roomMutex);
+                this->roomCv.notify_all();  // the pushes waiting for room in the queue do not wait any more
+            }
+            for (int i = 0; i < static_cast<int>(this->threads.size()); ++i) {  // wait for the computing threads to finish
+                    if (this->threads[i]->joinable())
+                        this->threads[i]->join();
+            }
+            for (auto & r : retirees)  // and for the threads removed by resize() that are still running
+                r.thread->join();
+            // if there were no threads in the pool but some functors in the queue, the functors are not deleted by the threads
+            // therefore delete them here
+            std::unique_lock<std::mutex> lock(this->resizeMutex);
+            nDeleted += this->timers.clear();  // before the queue, the continuations of the deleted functors are pushed to it
+            nDeleted += this->clear_queue();
+            this->threads.clear();
+            this->nThreads = 0;
+            this->retire_workers(0);
+            this->publish_deques();
+            return nDeleted;
+        }
+
+        // the functors that do not fit in a bounded queue are run here one by one, the rest go to the queue in chunks
+        void push_tasks(std::vector<detail::task> & tasks) {
+            if (this->is_closed())
+                return tasks.clear();
+            auto first = tasks.begin();
+            while (first != tasks.end()) {
+                int n = this->admit(static_cast<int>(tasks.end() - first));
+                if (n == 0) {
+                    this->run_here(std::move(*first++));
+                    continue;
+                }
+                this->enqueue(first, first + n);
+                this->notify(n);
+                first += n;
+            }
+        }
+
+        // pushes a functor made in place from args with its future
+        template <typename R, typename Function, typename... Args>
+        future<R> push_state(priority p, Args &&... args) {
+            auto state = this->template make_state<R, Function>(std::forward<Args>(args)...);
+            future<R> result(state);
+            this->push_task(detail::task(detail::packaged_task<R, Function>(state)), p);
+            return result;
+        }
+
+        template <typename R, typename Function, typename... Args>
+        future<R> timed_state(std::chrono::steady_clock::time_point due, Args &&... args) {
+            auto state = this->template make_state<R, Function>(std::forward<Args>(args)...);
+            future<R> result(state);
+            this->add_timer(due, detail::task(detail::packaged_task<R, Function>(state)));
+            return result;
+        }
+
+        template <typename R, typename Function, typename... Args>
+        future<R> push_until(std::chrono::steady_clock::time_point until, Args &&... args) {
+            if (this->is_closed() || this->acquire(1, until) == 0)
+                return future<R>();
+            auto state = this->template make_state<R, Function>(std::forward<Args>(args)...);
+            future<R> result(state);
+            this->enqueue(detail::task(detail::packaged_task<R, Function>(state)));
+            this->notify(1);
+            return result;
+        }
+
+        // pushes a functor made in place from args to the inbox of the thread of [first, last) with the fewest functors in the inboxes
+        template <typename R, typename Function, typename... Args>
+        future<R> inbox_state(affinity a, const int * first, const int * last, Args &&... args) {
+            if (first == last)
+                throw std::invalid_argument("ctpl::thread_pool::push_to_group() with no threads");
+            std::shared_ptr<const Workers> ws = std::atomic_load(&this->published);
+            detail::worker_state * target = nullptr;
+            for (; first != last; ++first) {
+                if (*first < 0 || *first >= static_cast<int>(ws->size()))
+                    throw std::out_of_range("ctpl::thread_pool has no thread " + std::to_string(*first));
+                detail::worker_state * w = (*ws)[*first].get();
+                if (!target || w->pinned.size() + w->shared.size() < target->pinned.size() + target->shared.size())
+                    target = w;
+            }
+            auto state = this->template make_state<R, Function>(std::forward<Args>(args)...);
+            future<R> result(state);
+            this->enqueue_to(*target, a, detail::task(detail::packaged_task<R, Function>(state)));
+            return result;
+        }
+
+        // the waiting threads are all woken up for a strict functor, as only one of them may run it
+        void enqueue_to(detail::worker_state & w, affinity a, detail::task && t) {
+            if (this->is_closed())
+                return t.reset();
+            this->nUnfinished.fetch_add(1, std::memory_order_relaxed);
+            t.stamp();
+            this->queueStats.push(1);
+            this->count_unstarted(1);
+            if (this->capacity.load(std::memory_order_relaxed) > 0)
+                this->nQueued.fetch_add(1, std::memory_order_relaxed);
+            bool isShared = a == affinity::preferred;
+            if (isShared)
+                this->nShared.fetch_add(1, std::memory_order_relaxed);  // before the push, so a thief does not miss it
+            if (!(isShared ? w.shared : w.pinned).push(std::move(t))) {  // the thread has returned, any thread runs it
+                if (isShared)
+                    this->nShared.fetch_sub(1, std::memory_order_relaxed);
+                if (!this->q.push(std::move(t))) {
+                    this->queueStats.remove(1);
+                    this->release(1);
+                    this->finish(1);
+                    throw std::bad_alloc();
+                }
+                isShared = true;
+            }
+            this->notify(isShared ? 1 : std::numeric_limits<int>::max());
+        }
+
+        void enqueue(detail::task && t, priority p = priority::normal) {
+            this->nUnfinished.fetch_add(1, std::memory_order_relaxed);
+            t.stamp();
+            this->queueStats.push(1);
+            this->count_unstarted(1);
+            this_worker & w = current();
+            bool isPushed = true;
+            if (p != priority::normal) {
+                this->open_lanes();
+                isPushed = (p == priority::high ? this->qHigh : this->qLow).push(std::move(t));
+            }
+            else if (w.pool == this && w.deque)
+                w.deque->push(detail::this_boxes().box(std::move(t)));
+            else
+                isPushed = this->queue_here().push(std::move(t));
+            if (!isPushed) {  // the queue could not take it, e.g. could not get a node
+                this->queueStats.remove(1);
+                this->release(1);
+                this->finish(1);
+                throw std::bad_alloc();
+            }
+        }
+
+        template <typename It>
+        void enqueue(It first, It last) {
+            this->nUnfinished.fetch_add(static_cast<int>(last - first), std::memory_order_relaxed);
+            for (It k = first; k != last; ++k)
+                k->stamp();
+            this->queueStats.push(static_cast<int>(last - first));
+            this->count_unstarted(static_cast<int>(last - first));
+            this_worker & w = current();
+            if (w.pool == this && w.deque) {
+                for (; first != last; ++first)
+                    w.deque->push(detail::this_boxes().box(std::move(*first)));
+                return;
+            }
+            It rest = this->queue_here().push(first, last);
+            if (rest != last) {  // the ones moved in are run, the rest is dropped
+                int n = static_cast<int>(last - rest);
+                this->queueStats.remove(n);
+                this->release(n);
+                this->finish(n);
+                this->notify(static_cast<int>(rest - first));
+                throw std::bad_alloc();
+            }
+        }
+
+        // takes places in a bounded queue for up to n functors as the overflow mode says, 0 if the caller should run a functor itself
+        int admit(int n) {
+            if (this->capacity.load(std::memory_order_relaxed) == 0)
+                return n;
+            bool isWaiting = !this->isCallerRuns.load(std::memory_order_relaxed) && current().pool != this;
+            return this->acquire(n, isWaiting ? std::chrono::steady_clock::time_point::max() : std::chrono::steady_clock::time_point::min());
+        }
+
+        // takes places for up to n functors, waits until there is room or the time runs out, returns the number of places taken
+        // there is no limit once the pool is stopped
+        int acquire(int n, std::chrono::steady_clock::time_point until) {
+            int capacity = this->capacity.load(std::memory_order_relaxed);
+            if (capacity == 0)
+                return n;
+            int nQueued = this->nQueued.load(std::memory_order_relaxed);
+            while (true) {
+                while (nQueued < capacity) {
+                    int k = std::min(n, capacity - nQueued);
+                    if (this->nQueued.compare_exchange_weak(nQueued, nQueued + k, std::memory_order_relaxed))
+                        return k;
+                }
+                if (this->isStop || this->isDone)
+                    return n;
+                if (until == std::chrono::steady_clock::time_point::min())
+                    return 0;
+                std::unique_lock<std::mutex> lock(this->roomMutex);
+                ++this->nBlocked;
+                std::atomic_thread_fence(std::memory_order_seq_cst);  // see release()
+                auto isRoom = [this, &nQueued, capacity]() {
+                    nQueued = this->nQueued.load(std::memory_order_relaxed);
+                    return nQueued < capacity || this->isStop || this->isDone;
+                };
+                bool isWoken = true;
+                if (until == std::chrono::steady_clock::time_point::max())
+                    this->roomCv.wait(lock, isRoom);
+                else
+                    isWoken = this->roomCv.wait_until(lock, until, isRoom);
+                --this->nBlocked;
+                if (!isWoken)
+                    return 0;
+            }
+        }
+
+        // gives back the places of n functors taken from a bounded queue and wakes up the pushes waiting for them, like notify()
+        void release(int n) {
+            this->count_unstarted(-n);
+            if (n == 0 || this->capacity.load(std::memory_order_relaxed) == 0)
+                return;
+            this->nQueued.fetch_sub(n, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (this->nBlocked.load(std::memory_order_relaxed) == 0)
+                return;
+            std::unique_lock<std::mutex> lock(this->roomMutex);
+            if (n >= this->nBlocked)
+                this->roomCv.notify_all();
+            else {
+                for (int k = 0; k < n; ++k)
+                    this->roomCv.notify_one();
+            }
+        }
+
+        // after drain(), only the threads of the pool may push
+        bool is_closed() {
+            return this->isClosed.load(std::memory_order_relaxed) && current().pool != this;
+        }
+
+        // n functors counted by wait_idle() are finished or deleted, the fences order it like notify() and release()
+        void finish(int n) {
+            if (n == 0 || this->nUnfinished.fetch_sub(n, std::memory_order_acq_rel) != n)
+                return;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (this->nIdleWaiting.load(std::memory_order_relaxed) == 0)
+                return;
+            std::unique_lock<std::mutex> lock(this->idleMutex);
+            this->idleCv.notify_all();
+        }
+
+        bool wait_idle_until(std::chrono::steady_clock::time_point until) {
+            // the rings of the producers first, a functor is counted before it leaves its ring
+            auto isIdle = [this]() { return !this->is_staged() && this->nUnfinished.load(std::memory_order_acquire) == 0; };
+            if (isIdle())
+                return true;
+            std::unique_lock<std::mutex> lock(this->idleMutex);
+            ++this->nIdleWaiting;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool isDone = true;
+            if (until == std::chrono::steady_clock::time_point::max())
+                this->idleCv.wait(lock, isIdle);
+            else
+                isDone = this->idleCv.wait_until(lock, until, isIdle);
+            --this->nIdleWaiting;
+            return isDone;
+        }
+
+        // the functors pushed but not started yet are counted only for the scaling thread
+        void count_unstarted(int n) {
+            if (n != 0 && this->isScaling.load(std::memory_order_relaxed))
+                this->nUnstarted.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        // the scaling thread, see set_autoscale(), it stops when _flag is set
+        // a thread is added when the queue stayed too deep for bounds.sustain, then twice as many threads each time it stays so
+        // the fewest threads idle at any look during bounds.keepAlive are not needed and retire
+        void scale(const autoscale & bounds, std::atomic<bool> & _flag) {
+            typedef std::chrono::steady_clock Clock;
+            auto tick = std::max(std::chrono::milliseconds(1), std::min(bounds.sustain, bounds.keepAlive) / 4);
+            Clock::time_point busySince = Clock::time_point::max();
+            Clock::time_point spareSince = Clock::now();
+            int nSpare = this->n_idle();  // the fewest idle threads since spareSince
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(this->scalerMutex);
+                    if (this->scalerCv.wait_for(lock, tick, [&_flag](){ return _flag.load(); }))
+                        return;
+                }
+                auto now = Clock::now();
+                int nIdle = this->n_idle();
+                bool isBusy = nIdle == 0 && this->nUnstarted.load(std::memory_order_relaxed) > bounds.queueDepth;
+                if (!isBusy)
+                    busySince = Clock::time_point::max();
+                else if (busySince == Clock::time_point::max())
+                    busySince = now;
+                nSpare = std::min(nSpare, nIdle);
+                if (nSpare == 0) {
+                    spareSince = now;
+                    nSpare = nIdle;
+                }
+                int n = this->size();
+                int nThreads = n;
+                if (busySince != Clock::time_point::max() && now - busySince >= bounds.sustain && n < bounds.maxThreads) {
+                    nThreads = std::min(bounds.maxThreads, n + std::max(1, n));
+                    busySince = now;
+                }
+                else if (now - spareSince >= bounds.keepAlive) {
+                    nThreads = std::max(std::min(n, bounds.minThreads), n - nSpare);
+                    spareSince = now;
+                    nSpare = nIdle;
+                }
+                if (nThreads == n)
+                    continue;
+                std::unique_lock<std::mutex> lock(this->resizeMutex);
+                if (_flag)
+                    return;
+                this->resize_threads(nThreads);
+                spareSince = now;
+                nSpare = this->n_idle();
+            }
+        }
+
+        // tells the scaling thread to stop, returns it to be joined without the lock of resize()
+        std::unique_ptr<std::thread> take_scaler() {
+            if (this->scalerFlag) {
+                std::unique_lock<std::mutex> lock(this->scalerMutex);
+                *this->scalerFlag = true;
+                this->scalerCv.notify_all();
+            }
+            this->scalerFlag.reset();
+            return std::move(this->scaler);
+        }
+
+        void run_here(detail::task && t) {
+            detail::task func(std::move(t));
+            try {
+                func(-1);
+            }
+            catch (...) {
+                this->on_error(-1, std::current_exception());
+            }
+        }
+
+        // wakes up to n waiting threads, the mutex is not touched if no thread is waiting
+        // the fence here orders the push of the functors before the load of nWaiting, the fence in the thread orders
+        // the increment of nWaiting before its pop, so either the thread finds the functors or it is seen waiting here
+        void notify(int n) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (this->nWaiting.load(std::memory_order_relaxed) == 0)
+                return;
+            std::unique_lock<std::mutex> lock(this->mutex);
+            if (n >= this->nWaiting)
+                this->cv.notify_all();
+            else {
+                for (int k = 0; k < n; ++k)
+                    this->cv.notify_one();
+            }
+        }
+
+        // pop_task() after the due timers and the functors of the producers are moved to the queue, not to be called with the mutex locked
+        // the rings are looked at on every 16th pop, so a busy queue does not keep the functors of a producer waiting
+        bool next_task(int i, Deque * deque, std::shared_ptr<const Deques> & victims, int & version, detail::task & t) {
+            if (this->timers.is_due())
+                this->fire_timers();
+            if (this->nProducers.load(std::memory_order_relaxed) > 0 && (++current().nPops & 15) == 0)
+                this->drain_staged();
+            return this->pop_task(i, deque, victims, version, t) || (this->drain_staged() && this->pop_task(i, deque, victims, version, t));
+        }
+
+        bool pop_task(int i, Deque * deque, std::shared_ptr<const Deques> & victims, int & version, detail::task & t) {
+            if (!this->pop_taken(t) && !this->pop_inbox(t) && !this->find_task(i, deque, victims, version, t) && !this->steal_inbox(t))
+                return false;
+            this->release(1);
+            return true;
+        }
+
+        // the lanes of the high and the low priority are looked at only after something is pushed to them,
+        // then they take turns with the normal lane: of 13 turns 8 start from the high lane, 4 from the normal one and 1 from the low one
+        bool find_task(int i, Deque * deque, std::shared_ptr<const Deques> & victims, int & version, detail::task & t) {
+            if (!this->isPrioritized.load(std::memory_order_relaxed))
+                return this->find_normal(i, deque, victims, version, t);
+            unsigned turn = current().turn++ % 13;
+            bool isHighFirst = turn < 8 || turn == 12;
+            if (turn == 12 && this->pop_lane(this->qLow, t))
+                return true;
+            if (isHighFirst && this->pop_lane(this->qHigh, t))
+                return true;
+            if (this->find_normal(i, deque, victims, version, t))
+                return true;
+            return (!isHighFirst && this->pop_lane(this->qHigh, t)) || this->pop_lane(this->qLow, t);
+        }
+
+        // the functors pushed to the calling thread of this pool by push_to()
+        bool pop_inbox(detail::task & t) {
+            this_worker & w = current();
+            return w.pool == this && w.state && (w.state->pinned.pop(t) || this->pop_shared(*w.state, t));
+        }
+
+        // a functor pushed to another thread with affinity::preferred, when the calling thread of this pool has nothing else to run
+        bool steal_inbox(detail::task & t) {
+            if (this->nShared.load(std::memory_order_relaxed) <= 0 || current().pool != this)
+                return false;
+            std::shared_ptr<const Workers> ws = std::atomic_load(&this->published);
+            for (auto & w : *ws) {
+                if (this->pop_shared(*w, t)) {
+                    current().stats->steal();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool pop_shared(detail::worker_state & w, detail::task & t) {
+            if (!w.shared.pop(t))
+                return false;
+            this->nShared.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // a functor of a producer goes to its ring, counted by wait_idle() only once it is moved to the queue, see take_staged()
+        void stage(detail::staging & ring, detail::task && t) {
+            if (this->is_closed())
+                return t.reset();
+            if (this->capacity.load(std::memory_order_relaxed) > 0)
+                return this->push_task(std::move(t));  // a bounded queue counts every functor
+            t.stamp();
+            if (!ring.push(std::move(t)))
+                return this->push_task(std::move(t));  // the ring is full
+            this->queueStats.push(1);
+            this->count_unstarted(1);
+            this->notify(1);
+        }
+
+        // moves the functors in the ring to the queue of the calling thread, with the lock of the ring taken, returns how many
+        // they are counted by wait_idle() before they can be run and before they leave the ring, see wait_idle_until()
+        int take_staged(detail::staging & ring) {
+            int n = static_cast<int>(ring.size());
+            if (n == 0)
+                return 0;
+            this->nUnfinished.fetch_add(n, std::memory_order_relaxed);
+            NodeQueue & q = this->queue_here();
+            int nMoved = static_cast<int>(ring.take(n, [&q](detail::task * first, detail::task * last) { return q.push(first, last); }));
+            this->finish(n - nMoved);  // the ones the queue could not take stay in the ring
+            return nMoved;
+        }
+
+        // moves the functors of the producers that no other thread is moving now to the queue, returns if there were any
+        bool drain_staged() {
+            if (this->nProducers.load(std::memory_order_relaxed) == 0)
+                return false;
+            std::shared_ptr<const Producers> copy;
+            const Producers * ps;
+            this_worker & w = current();
+            if (w.pool == this) {  // the copy of the thread is replaced only when the producers change
+                int version = this->producersVersion.load(std::memory_order_acquire);
+                if (w.producersVersion != version) {
+                    w.producers = std::atomic_load(&this->producers);
+                    w.producersVersion = version;
+                }
+                ps = w.producers.get();
+            }
+            else {
+                copy = std::atomic_load(&this->producers);
+                ps = copy.get();
+            }
+            int n = 0;
+            for (auto & ring : *ps) {
+                if (ring->empty())
+                    continue;
+                std::unique_lock<detail::staging> lock(*ring, std::try_to_lock);
+                if (lock)
+                    n += this->take_staged(*ring);
+            }
+            if (n > 1)
+                this->notify(n - 1);  // the calling thread runs one of them
+            return n > 0;
+        }
+
+        bool is_staged() {
+            if (this->nProducers.load(std::memory_order_relaxed) == 0)
+                return false;
+            std::shared_ptr<const Producers> ps = std::atomic_load(&this->producers);
+            for (auto & ring : *ps) {
+                if (!ring->empty())
+                    return true;
+            }
+            return false;
+        }
+
+        // the functors left in the ring of a destroyed handle go to the queue, then the ring is not looked at any more
+        void remove_producer(const std::shared_ptr<detail::staging> & ring) {
+            {
+                std::unique_lock<detail::staging> lock(*ring);
+                int n = this->take_staged(*ring);
+                this->notify(n);
+                int nLeft = static_cast<int>(ring->size());  // deleted with the ring, their futures get the broken promise error
+                this->release(nLeft);
+                this->queueStats.remove(nLeft);
+            }
+            std::unique_lock<std::mutex> lock(this->producersMutex);
+            auto ps = std::make_shared<Producers>();
+            for (auto & r : *this->producers) {
+                if (r != ring)
+                    ps->push_back(r);
+            }
+            std::atomic_store(&this->producers, std::shared_ptr<const Producers>(ps));
+            this->producersVersion.fetch_add(1, std::memory_order_release);
+            this->nProducers.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        // the functors left in the batch and the inboxes of a returning thread are moved to the queue to be run by the other threads,
+        // the ones the queue cannot take are run by the returning thread, see run_left()
+        void close_inboxes(detail::worker_state & w) {
+            std::vector<detail::task> left;
+            w.batch.close(left);
+            w.pinned.close(left);
+            this->nShared.fetch_sub(w.shared.close(left), std::memory_order_relaxed);
+            if (left.empty())
+                return;
+            for (auto & t : left) {
+                if (!this->q.push(std::move(t)))
+                    this->run_left(std::move(t));
+            }
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->cv.notify_all();
+        }
+
+        static bool pop_lane(QueuePolicy & q, detail::task & t) {
+            return q.pop(t);
+        }
+
+        // from the queue, with the batch size > 1 a thread of this pool takes more functors at once, see set_batch()
+        bool pop_queue(QueuePolicy & q, detail::task & t) {
+            int n = this->batchSize.load(std::memory_order_relaxed);
+            this_worker & w = current();
+            if (n <= 1 || !detail::has_batch_pop<QueuePolicy>::value || w.pool != this || !w.state)
+                return q.pop(t);
+            int nShares = std::max(1, this->size());
+            return w.state->batch.fill(t, n, [&q, nShares](detail::task * out, int nMax) {
+                return detail::pop_batch(q, out, nMax, nShares, std::integral_constant<bool, detail::has_batch_pop<QueuePolicy>::value>());
+            });
+        }
+
+        // the functors of the batch taken before by the calling thread of this pool
+        bool pop_taken(detail::task & t) {
+            this_worker & w = current();
+            return w.pool == this && w.state && w.state->batch.pop(t);
+        }
+
+        // the queue of the numa node of the calling thread, or the shared queue
+        NodeQueue & queue_here() {
+            if (this->nodeQueues.empty())
+                return this->q;
+            this_worker & w = current();
+            int node = w.pool == this ? w.node : this->node_of(detail::current_cpu());
+            return node >= 0 ? *this->nodeQueues[node] : this->q;
+        }
+
+        int node_of(int cpu) const {
+            return cpu >= 0 && cpu < static_cast<int>(this->nodeOfCpu.size()) ? this->nodeOfCpu[cpu] : -1;
+        }
+
+        // from the queue of the node of the calling thread first, then from the queues of the other nodes in turn
+        bool pop_nodes(detail::task & t) {
+            int n = static_cast<int>(this->nodeQueues.size());
+            if (n == 0)
+                return false;
+            this_worker & w = current();
+            int node = w.pool == this && w.node >= 0 ? w.node : 0;
+            for (int k = 0; k < n; ++k) {
+                if (this->pop_queue(*this->nodeQueues[(node + k) % n], t))
+                    return true;
+            }
+            return false;
+        }
+
+        // the flag is only set once, the fences of notify() and the waiting thread order it like the functor itself
+        void open_lanes() {
+            if (!this->isPrioritized.load(std::memory_order_relaxed))
+                this->isPrioritized.store(true, std::memory_order_relaxed);
+        }
+
+        // the next functor of the normal lane for the thread i: from its own deque, then from the queue, then stolen from the other threads
+        bool find_normal(int i, Deque * deque, std::shared_ptr<const Deques> & victims, int & version, detail::task & t) {
+            detail::task * _f;
+            if (deque && deque->pop(_f))
+                return unbox(_f, t);
+            if (this->pop_nodes(t) || this->pop_queue(this->q, t))
+                return true;
+            if (!deque)
+                return false;
+            if (version != this->dequesVersion.load(std::memory_order_acquire)) {  // the pool was resized
+                version = this->dequesVersion.load(std::memory_order_acquire);
+                victims = std::atomic_load(&this->victims);
+            }
+            int n = static_cast<int>(victims->size());
+            for (int k = 1; k < n; ++k) {
+                Deque * victim = (*victims)[(i + k) % n].get();
+                if (victim != deque && victim->steal(_f)) {
+                    current().stats->steal();
+                    return unbox(_f, t);
+                }
+            }
+            return false;
+        }
+
+        static bool unbox(detail::task * _f, detail::task & t) {
+            detail::this_boxes().unbox(_f, t);
+            return true;
+        }
+
+        // give the other threads the current list of the deques to steal from
+        void publish_deques() {
+            std::atomic_store(&this->published, std::shared_ptr<const Workers>(std::make_shared<Workers>(this->workers)));
+            if (!this->isStealing)
+                return;
+            std::shared_ptr<Deques> deques = std::make_shared<Deques>();
+            for (auto & w : this->workers)
+                deques->push_back(std::shared_ptr<Deque>(w, &w->deque));
+            std::atomic_store(&this->victims, std::shared_ptr<const Deques>(deques));
+            this->dequesVersion.fetch_add(1, std::memory_order_release);
+        }
+
+        // resize() with the lock taken
+        void resize_threads(int nThreads) {
+            if (!this->isStop && !this->isDone) {
+                this->join_retirees();
+                int oldNThreads = static_cast<int>(this->threads.size());
+                if (oldNThreads <= nThreads) {  // if the number of threads is increased
+                    this->threads.resize(nThreads);
+                    for (int i = oldNThreads; i < nThreads; ++i)
+                        this->workers.push_back(std::make_shared<detail::worker_state>());
+                    this->publish_deques();  // before the new threads start to steal or anything is pushed to them
+                    for (int i = oldNThreads; i < nThreads; ++i)
+                        this->set_thread(i);
+                    this->nThreads = nThreads;
+                }
+                else {  // the number of threads is decreased
+                    for (int i = oldNThreads - 1; i >= nThreads; --i) {
+                        this->workers[i]->flag = true;  // this thread will finish its functor and return
+                        retiree r = { std::move(this->threads[i]), this->workers[i] };
+                        this->retirees.push_back(std::move(r));
+                    }
+                    {
+                        // stop the retired threads that were waiting
+                        std::unique_lock<std::mutex> lock(this->mutex);
+                        this->cv.notify_all();
+                    }
+                    this->threads.resize(nThreads);  // the retired threads are joined later, see join_retirees()
+                    this->nThreads = nThreads;
+                    // safe to delete because the threads have copies of shared_ptr of their states, not originals
+                    // the retired threads move what is left in their deques to the queue
+                    this->retire_workers(nThreads);
+                    this->publish_deques();
+                }
+            }
+        }
+
+        // joins the retired threads that have returned, the others are left for the next resize() or for stop()
+        // so resize() does not wait for the functors of the retired threads and may be called from one of them
+        void join_retirees() {
+            auto isRunning = [](const retiree & r) { return !r.worker->isFinished; };
+            auto running = std::partition(this->retirees.begin(), this->retirees.end(), isRunning);
+            for (auto k = running; k != this->retirees.end(); ++k)
+                k->thread->join();
+            this->retirees.erase(running, this->retirees.end());
+        }
+
+        void set_thread(int i) {
+            std::shared_ptr<detail::worker_state> worker(this->workers[i]); // a copy of the shared ptr to the state of the thread
+            std::vector<int> cpus;
+            if (!this->where.cpus.empty())
+                cpus = this->where.cpus[i % this->where.cpus.size()];
+            auto f = [this, i, worker/* a copy of the shared ptr to the state */, cpus]() {
+                std::atomic<bool> & _flag = worker->flag;
+                Deque * deque = this->isStealing ? &worker->deque : nullptr;
+                detail::worker_stats * stats = &worker->stats;
+                if (!cpus.empty())
+                    detail::pin_this_thread(cpus);
+                this_worker & w = current();
+                w.pool = this;
+                w.deque = deque;
+                w.stats = stats;
+                w.id = i;
+                w.state = worker.get();
+                w.node = this->nodeQueues.empty() ? -1 : this->node_of(detail::current_cpu());
+                detail::worker_hook hook = { this, &basic_thread_pool::run_one, &basic_thread_pool::post_task, i };
+                detail::this_hook() = hook;
+                std::shared_ptr<const Deques> victims;
+                int version = -1;
+                detail::task t;
+                bool isPop = this->next_task(i, deque, victims, version, t);
+                while (true) {
+                    while (isPop) {  // if there is anything in the queue
+                        this->run_task(i, std::move(t), *stats, worker->trace);
+                        if (_flag) {
+                            this->release_deque(deque);
+                            return;  // the thread is wanted to stop, return even if the queue is not empty yet
+                        }
+                        else
+                            isPop = this->next_task(i, deque, victims, version, t);
+                    }
+                    // the queue is empty here, spin and yield as the idle policy says
+                    isPop = this->idle(i, deque, victims, version, t, _flag);
+                    if (isPop)
+                        continue;
+                    // still empty, wait for the next command
+                    detail::flush_blocks();  // the blocks freed for the other threads are not kept while waiting
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    ++this->nWaiting;
+                    std::atomic_thread_fence(std::memory_order_seq_cst);  // see notify()
+                    bool isDue = false;
+                    bool isStaged = false;
+                    auto isReady = [this, i, &deque, &victims, &version, &t, &isPop, &isDue, &isStaged, &_flag](){
+                        isPop = this->pop_task(i, deque, victims, version, t);
+                        isDue = !isPop && this->timers.is_due();  // moved to the queue below, without the mutex
+                        isStaged = !isPop && !isDue && this->is_staged();  // as well
+                        return isPop || isDue || isStaged || this->isDone || _flag;
+                    };
+                    bool isKeeper = false;
+                    while (!isReady())
+                        isKeeper = this->wait(lock) || isKeeper;
+                    --this->nWaiting;
+                    if (isKeeper && this->timers.is_pending() && this->nWaiting > 0)
+                        this->cv.notify_one();  // another waiting thread keeps the time
+                    if (!isPop) {
+                        if (_flag || (!isStaged && (!isDue || this->isDone)))
+                            return;  // if the queue is empty and this->isDone == true or *flag then return
+                        lock.unlock();
+                        isPop = this->next_task(i, deque, victims, version, t);
+                    }
+                }
+            };
+            this->threads[i].reset(new std::thread([this, f, worker]() {  // compiler may not support std::make_unique()
+                f();
+                this->close_inboxes(*worker);
+                worker->isFinished = true;  // the pool is not touched after this, see join_retirees()
+            }));
+        }
+
+        void run_task(int i, detail::task && t, detail::worker_stats & stats, detail::worker_trace & trace) {
+            {
+                detail::task func(std::move(t)); // at return, delete the function even if an exception occurred
+                stats.start(func);
+                auto started = trace.start();  // kept here, as a functor waiting for a future may run others meanwhile
+                try {
+                    func(i);
+                }
+                catch (...) {  // only a function pushed with post() may throw here
+                    this->on_error(i, std::current_exception());
+                }
+                stats.finish();
+                trace.finish(func, started);
+            }
+            this->finish(1);  // once the functor is deleted too
+        }
+
+        // runs one functor on the calling thread of the pool while it waits for a future, see detail::worker_hook
+        static bool run_one(void * pool) {
+            basic_thread_pool * self = static_cast<basic_thread_pool *>(pool);
+            this_worker & w = current();
+            std::shared_ptr<const Deques> victims;
+            int version = -1;
+            detail::task t;
+            if (!self->next_task(w.id, w.deque, victims, version, t))
+                return false;
+            self->run_task(w.id, std::move(t), *w.stats, w.state->trace);
+            return true;
+        }
+
+        // looks for a functor until the idle policy says to wait, returns true if one is popped
+        bool idle(int i, Deque * deque, std::shared_ptr<const Deques> & victims, int & version, detail::task & t, std::atomic<bool> & _flag) {
+            int nSpins = this->idlePolicy.spins();
+            if (nSpins <= 0 && this->idlePolicy.yields() <= 0 && this->idlePolicy.parks())
+                return false;
+            ++this->nSpinning;
+            bool isPop = false;
+            for (int k = 0; !isPop && k < nSpins && !this->isDone && !_flag; ++k) {
+                detail::cpu_relax();
+                isPop = this->next_task(i, deque, victims, version, t);
+            }
+            for (int k = 0; !isPop && !this->isDone && !_flag; ++k) {
+                if (k >= this->idlePolicy.yields() && this->idlePolicy.parks())
+                    break;  // read each time, so a thread that does not park stops yielding when the policy is changed
+                std::this_thread::yield();
+                isPop = this->next_task(i, deque, victims, version, t);
+            }
+            --this->nSpinning;
+            return isPop;
+        }
+
+        // removes the states of the threads from nThreads on, their counters are still counted in the totals
+        // and the traces of the last nRetiredTraces of them are still written
+        void retire_workers(int nThreads) {
+            for (int i = nThreads; i < static_cast<int>(this->workers.size()); ++i) {
+                this->retiredStats.push_back(std::shared_ptr<detail::worker_stats>(this->workers[i], &this->workers[i]->stats));
+#if _ctplThreadPoolTrace_
+                this->retiredTraces.push_back(std::make_pair(i, std::shared_ptr<const detail::worker_trace>(this->workers[i], &this->workers[i]->trace)));
+                if (this->retiredTraces.size() > nRetiredTraces)
+                    this->retiredTraces.pop_front();
+#endif
+            }
+            this->workers.resize(nThreads);
+        }
+
+        void on_error(int i, std::exception_ptr e) {
+            std::function<void(int id, std::exception_ptr e)> handler;
+            {
+                std::unique_lock<std::mutex> lock(this->errorMutex);
+                handler = this->errorHandler;
+            }
+            if (handler)
+                handler(i, e);
+        }
+
+        // the functors left in the deque of a stopping thread are moved to the queue to be run by the other threads
+        void release_deque(Deque * deque) {
+            if (!deque)
+                return;
+            current().deque = nullptr;
+            detail::task * _f;
+            bool isMoved = false;
+            while (deque->pop(_f)) {
+                detail::task t;
+                unbox(_f, t);
+                if (this->q.push(std::move(t)))
+                    isMoved = true;
+                else
+                    this->run_left(std::move(t));
+            }
+            if (isMoved) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->cv.notify_all();
+            }
+        }
+
+        // a functor left to a stopping thread that the queue could not take, e.g. could not get a node, is run by that thread
+        // instead of being dropped, as it is counted by wait_idle()
+        void run_left(detail::task && t) {
+            this->release(1);
+            this_worker & w = current();
+            this->run_task(w.id, std::move(t), *w.stats, w.state->trace);
+        }
+
+        void init(ctpl::schedule mode) {
+            this->nWaiting = 0; this->isStop = false; this->isDone = false;
+            this->isStealing = mode == ctpl::schedule::work_stealing;
+            this->dequesVersion = 0;
+            this->nSpinning = 0;
+            this->isPrioritized = false;
+            this->nQueued = 0; this->nBlocked = 0;
+            this->set_capacity(0);
+            this->nThreads = 0;
+            this->isScaling = false; this->nUnstarted = 0;
+            this->nShared = 0;
+            this->batchSize = 1;
+            this->isClosed = false;
+            this->nUnfinished = 0; this->nIdleWaiting = 0;
+            this->producers = std::make_shared<Producers>();
+            this->producersVersion = 0; this->nProducers = 0;
+            this->published = std::make_shared<Workers>();
+        }
+
+        std::vector<std::unique_ptr<std::thread>> threads;
+        std::vector<std::shared_ptr<detail::worker_state>> workers;  // one per thread
+        std::vector<retiree> retirees;  // the threads removed by resize() and not joined yet
+        std::shared_ptr<const Deques> victims;  // the deques of the threads to steal from if work stealing, replaced on resize
+        std::shared_ptr<const Workers> published;  // a copy of workers for push_to(), replaced on resize
+        bool isStealing;
+        placement where;
+        std::vector<std::unique_ptr<NodeQueue>> nodeQueues;  // one per numa node if the placement says so, otherwise empty
+        std::vector<int> nodeOfCpu;  // the index of the node queue for each cpu, -1 for none
+        std::vector<std::shared_ptr<detail::worker_stats>> retiredStats;  // of the threads removed by resize() or stop()
+#if _ctplThreadPoolTrace_
+        static const std::size_t nRetiredTraces = 64;
+        std::deque<std::pair<int, std::shared_ptr<const detail::worker_trace>>> retiredTraces;  // with the ids the threads had
+#endif
+        IdlePolicy idlePolicy;
+
+        std::function<void(int id, std::exception_ptr e)> errorHandler;
+        std::mutex errorMutex;
+
+        std::mutex resizeMutex;  // taken by resize(), stop() and the scaling thread to change the threads
+        std::unique_ptr<std::thread> scaler;  // the scaling thread if set_autoscale() was called
+        std::shared_ptr<std::atomic<bool>> scalerFlag;  // tells the scaling thread to stop
+        std::mutex scalerMutex;
+        std::condition_variable scalerCv;
+
+        // the state touched by every push and pop, the parts written by different threads are on cache lines of their own
+        char padQueue[64];
+        QueuePolicy q;  // the normal lane
+        char padLanes[64];
+        QueuePolicy qHigh;  // the lanes of the high and the low priority
+        QueuePolicy qLow;
+        char padFlags[64];  // read all the time, written seldom
+        std::atomic<int> dequesVersion;  // incremented when victims is replaced
+        std::atomic<bool> isPrioritized;  // if anything was pushed to the lanes
+        std::atomic<bool> isDone;
+        std::atomic<bool> isStop;
+        std::atomic<bool> isScaling;  // if nUnstarted is counted
+        std::atomic<int> capacity;  // of the queue, 0 if not bounded
+        std::atomic<bool> isCallerRuns;
+        std::atomic<bool> isClosed;  // by drain()
+        std::atomic<int> batchSize;  // see set_batch()
+        std::atomic<int> nThreads;  // threads.size(), also read without the lock
+        char padIdle[64];
+        std::atomic<int> nWaiting;  // how many threads are waiting
+        std::atomic<int> nSpinning;  // how many threads are idle but not waiting yet
+        char padMutex[64];
+        std::mutex mutex;
+        std::condition_variable cv;
+        char padTimers[64];
+        detail::timer_queue timers;  // of push_at(), post_at(), post_every() and the like
+        char padRoom[64];
+        std::atomic<int> nQueued;  // how many functors are in the queue, counted only if it is bounded
+        std::atomic<int> nBlocked;  // how many pushes wait for room in the queue
+        std::mutex roomMutex;
+        std::condition_variable roomCv;
+        char padUnstarted[64];
+        std::atomic<int> nUnstarted;  // the functors pushed but not started yet, counted for the scaling thread
+        char padUnfinished[64];
+        std::atomic<int> nUnfinished;  // the functors in the queue or running, for wait_idle()
+        std::atomic<int> nIdleWaiting;  // how many threads wait in wait_idle()
+        std::mutex idleMutex;
+        std::condition_variable idleCv;
+        char padShared[64];
+        std::atomic<int> nShared;  // the functors in the inboxes that any thread may run
+        char padProducers[64];  // read all the time, written when a producer is made or removed
+        std::atomic<int> nProducers;
+        std::atomic<int> producersVersion;  // incremented when producers is replaced
+        std::shared_ptr<const Producers> producers;  // the rings of the handles of make_producer()
+        std::mutex producersMutex;
+        detail::queue_stats queueStats;  // padded itself
+        char after[64];
+    };
+
+}
+
+#endif // __ctpl_core_H__
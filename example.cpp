@@ -60,8 +60,8 @@ int main(int argc, char **argv) {
             Third t(100);
 
             p.push(ugu, std::ref(t));  // function. reference
-            p.push(ugu, t);  // function. copy ctor, move ctor
-            p.push(ugu, std::move(t));  // function. move ctor, move ctor
+            p.push(ugu, t);  // function. copy ctor
+            p.push(ugu, std::move(t));  // function. move ctor
 
         }
         p.push(ugu, Third(200));  // function
@@ -110,6 +110,14 @@ int main(int argc, char **argv) {
         std::cout << "caught exception\n";
     }
 
+    // no future, the exceptions go to the error handler
+    p.set_error_handler([](int id, std::exception_ptr){
+        std::cout << "exception in thread " << id << '\n';
+    });
+    p.post([](int){
+        throw std::exception();
+    });
+
     // get thread 0
     auto & th = p.get_thread(0);
 
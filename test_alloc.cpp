@@ -0,0 +1,115 @@
+// counts the allocations of post() and push() once the pool is warm: none for a functor stored in place, one for a pushed one
+// prints one line per check and returns 1 if any of them failed
+//
+//     g++ -std=c++11 -O2 -pthread -I. test_alloc.cpp -o test_alloc                                                (ctpl.h, boost lockfree queue)
+//     g++ -std=c++11 -O2 -pthread -I. -D_ctplTestStl_ -D_ctplThreadPoolRing_=1024 test_alloc.cpp -o test_alloc_ring  (ctpl_stl.h, lock-free ring)
+//
+// not with the mutex queue, its std::queue allocates a new block for every few functors
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"  // the counting operator new below uses malloc(), seen inlined
+#endif
+#ifdef _ctplTestStl_
+#include <ctpl_stl.h>
+#else
+#include <ctpl.h>
+#endif
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <new>
+
+
+
+static std::atomic<long> nAllocs(0);  // by all the threads
+
+void * operator new(std::size_t n) {
+    ++nAllocs;
+    if (void * p = std::malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void * p) noexcept { std::free(p); }
+void operator delete(void * p, std::size_t) noexcept { std::free(p); }
+
+static int nFailed = 0;
+
+static void check(bool isOk, const std::string & what) {
+    std::cout << (isOk ? "ok   " : "FAIL ") << what << std::endl;
+    if (!isOk)
+        ++nFailed;
+}
+
+// the threads wait until it opens, so all the functors of a round are queued at once
+class gate {
+public:
+    gate() : isOpen(false) {}
+    void open() { this->isOpen = true; }
+    void close() { this->isOpen = false; }
+    void wait() const {
+        while (!this->isOpen)
+            std::this_thread::yield();
+    }
+private:
+    std::atomic<bool> isOpen;
+};
+
+static const int nThreads = 4, nJobs = 1000;
+
+// the allocations of a round of posts, the first round warms the pool up
+static long post_round(ctpl::thread_pool & pool, gate & g, std::atomic<int> & nRun) {
+    g.close();
+    for (int k = 0; k < nThreads; ++k)
+        pool.post([&g](int) { g.wait(); });
+    long before = nAllocs;
+    for (int k = 0; k < nJobs; ++k)
+        pool.post([&nRun](int) { ++nRun; });
+    g.open();
+    pool.wait_idle();
+    return nAllocs - before;
+}
+
+// the allocations of a round of pushes, the futures are kept until the end of the round
+static long push_round(ctpl::thread_pool & pool, gate & g, std::atomic<int> & nRun, std::vector<ctpl::future<int>> & fs) {
+    g.close();
+    for (int k = 0; k < nThreads; ++k)
+        pool.post([&g](int) { g.wait(); });
+    long before = nAllocs;
+    for (int k = 0; k < nJobs; ++k)
+        fs.push_back(pool.push([&nRun](int) { return ++nRun; }));
+    g.open();
+    pool.wait_idle();
+    long n = nAllocs - before;
+    fs.clear();
+    return n;
+}
+
+int main() {
+    for (int m = 0; m < 2; ++m) {
+        ctpl::schedule mode = m == 0 ? ctpl::schedule::fifo : ctpl::schedule::work_stealing;
+        std::string name = m == 0 ? "fifo" : "work stealing";
+        ctpl::thread_pool pool(nThreads, mode);
+        gate g;
+        std::atomic<int> nRun(0);
+        std::vector<ctpl::future<int>> fs;
+        fs.reserve(nJobs);
+
+        post_round(pool, g, nRun);
+        long n = post_round(pool, g, nRun);
+        check(n == 0, name + ": post() of a small functor to a warm pool, " + std::to_string(n) + " allocations");
+
+        push_round(pool, g, nRun, fs);
+        n = push_round(pool, g, nRun, fs);
+        check(n == nJobs, name + ": push() of a small functor to a warm pool, " + std::to_string(n) + " allocations for " + std::to_string(nJobs));
+
+        std::thread producer([&pool, &g, &nRun, &n]() {  // boxes emptied by the threads of the pool go back to the other threads
+            post_round(pool, g, nRun);
+            n = post_round(pool, g, nRun);
+        });
+        producer.join();
+        check(n == 0, name + ": post() from another thread, " + std::to_string(n) + " allocations");
+    }
+    std::cout << (nFailed == 0 ? "all passed" : std::to_string(nFailed) + " failed") << std::endl;
+    return nFailed == 0 ? 0 : 1;
+}
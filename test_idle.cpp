@@ -0,0 +1,233 @@
+// checks that wait_idle() and drain() return once the functors are finished or deleted, on the paths that delete
+// or move functors: clear_queue() with spawned coroutines and with batches taken, the deques spilled when a pool shrinks
+// prints one line per check and returns 1 if any of them failed
+//
+//     g++ -std=c++20 -O2 -pthread -I. test_idle.cpp -o test_idle                                            (ctpl.h, boost lockfree queue)
+//     g++ -std=c++20 -O2 -pthread -I. -D_ctplTestStl_ test_idle.cpp -o test_idle_stl                        (ctpl_stl.h, mutex queue)
+//     g++ -std=c++20 -O2 -pthread -I. -D_ctplTestStl_ -D_ctplThreadPoolRing_=1024 test_idle.cpp -o test_idle_ring  (ctpl_stl.h, lock-free ring)
+//
+// also with -fsanitize=address or -fsanitize=thread, and as c++11 without the coroutines
+
+#ifdef _ctplTestStl_
+#include <ctpl_stl.h>
+#else
+#include <ctpl.h>
+#endif
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+
+typedef std::chrono::steady_clock Clock;
+
+static int nFailed = 0;
+
+static void check(bool isOk, const std::string & what) {
+    std::cout << (isOk ? "ok   " : "FAIL ") << what << std::endl;
+    if (!isOk)
+        ++nFailed;
+}
+
+// drain() of a pool with nothing left must return at once and drained
+static void check_drained(ctpl::thread_pool & pool, const std::string & what) {
+    auto start = Clock::now();
+    ctpl::drain_result r = pool.drain(std::chrono::seconds(5));
+    check(r.isDrained && Clock::now() - start < std::chrono::seconds(5), what + ": drained");
+}
+
+// the functors stay in the queue until the gate opens
+class gate {
+public:
+    gate() : opened(promise.get_future().share()) {}
+    void open() { this->promise.set_value(); }
+    void wait() const { this->opened.wait(); }
+private:
+    std::promise<void> promise;
+    std::shared_future<void> opened;
+};
+
+#if _ctplThreadPoolCoroutines_
+static ctpl::task<int> seven(ctpl::thread_pool & pool) {
+    co_await pool.schedule();
+    co_return 7;
+}
+
+static ctpl::task<int> eight(ctpl::thread_pool & pool) {
+    int n = co_await seven(pool);
+    co_return n + 1;
+}
+
+template <typename R>
+static bool is_broken(ctpl::future<R> & f) {
+    if (f.wait_for(std::chrono::seconds(5)) != std::future_status::ready)
+        return false;
+    try {
+        f.get();
+    }
+    catch (std::future_error & e) {
+        return e.code() == std::future_errc::broken_promise;
+    }
+    return false;
+}
+
+static void test_coroutines() {
+    {
+        ctpl::thread_pool pool(0);
+        auto f = pool.spawn(seven(pool));
+        check(pool.clear_queue() == 1, "clear_queue() with a spawned coroutine: deleted");
+        check(is_broken(f), "clear_queue() with a spawned coroutine: broken promise");
+        check_drained(pool, "clear_queue() with a spawned coroutine");
+    }
+    {
+        ctpl::thread_pool pool(0);
+        auto f = pool.spawn(eight(pool));
+        pool.pop()(0);  // starts the coroutine here, it awaits schedule() in the task it awaits
+        check(pool.clear_queue() == 1, "clear_queue() with a nested coroutine: deleted");
+        check(is_broken(f), "clear_queue() with a nested coroutine: broken promise");
+        check_drained(pool, "clear_queue() with a nested coroutine");
+    }
+    {
+        ctpl::future<int> f;
+        {
+            ctpl::thread_pool pool(0);
+            f = pool.spawn(eight(pool));
+        }
+        check(is_broken(f), "a spawned coroutine of a destroyed pool without threads: broken promise");
+    }
+    {
+        ctpl::thread_pool pool(2);
+        gate g;
+        pool.push([&g](int) { g.wait(); });
+        pool.push([&g](int) { g.wait(); });
+        std::vector<ctpl::future<int>> fs;
+        for (int k = 0; k < 100; ++k)
+            fs.push_back(pool.spawn(eight(pool)));
+        std::thread opener([&g]() {  // stop() waits for the running functors
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            g.open();
+        });
+        pool.stop(false);
+        opener.join();
+        bool isBroken = true;
+        for (auto & f : fs)
+            isBroken = is_broken(f) && isBroken;
+        check(isBroken, "stop(false) with spawned coroutines: broken promises");
+    }
+    {
+        ctpl::thread_pool pool(1);
+        pool.drain(std::chrono::seconds(1));
+        auto f = pool.spawn(seven(pool));
+        check(is_broken(f), "a coroutine spawned on a drained pool: broken promise");
+    }
+    {
+        ctpl::thread_pool pool(4);
+        std::vector<ctpl::future<int>> fs;
+        for (int k = 0; k < 1000; ++k)
+            fs.push_back(pool.spawn(eight(pool)));
+        int sum = 0;
+        for (auto & f : fs)
+            sum += f.get();
+        check(sum == 8000, "spawned coroutines: results");
+        check_drained(pool, "spawned coroutines");
+    }
+}
+#endif
+
+static void test_batches() {
+    for (int k = 0; k < 20; ++k) {
+        ctpl::thread_pool pool(2);
+        pool.set_batch(8);
+        gate g;
+        std::atomic<int> nStarted(0), nRun(0);
+        for (int i = 0; i < 200; ++i)
+            pool.push([&g, &nStarted, &nRun](int) { ++nStarted; g.wait(); ++nRun; });
+        while (nStarted < 2)
+            std::this_thread::yield();
+        int nDeleted = pool.clear_queue();
+        g.open();
+        bool isIdle = pool.wait_idle(std::chrono::seconds(5));
+        if (k == 0 || !isIdle || nDeleted + nRun != 200) {
+            check(isIdle, "clear_queue() with batches taken: idle");
+            check(nDeleted + nRun == 200, "clear_queue() with batches taken: every functor run or deleted");
+            check(nDeleted == 198, "clear_queue() with batches taken: the batches deleted");
+        }
+
+        std::atomic<int> nPopped(0);
+        for (int i = 0; i < 100; ++i) {
+            pool.push([&pool, &nPopped](int id) {
+                if (nPopped++ != 0)
+                    return;
+                auto f = pool.pop();  // from a thread of the pool with a batch taken
+                if (f)
+                    f(id);
+                pool.clear_queue();
+            });
+        }
+        isIdle = pool.wait_idle(std::chrono::seconds(5));
+        if (k == 0 || !isIdle) {
+            check(isIdle, "pop() and clear_queue() from a thread with a batch taken: idle");
+            check_drained(pool, "batches");
+        }
+    }
+}
+
+// a functor that pushes two more down to the depth, so the deques of all the threads fill up
+static void fan_out(ctpl::thread_pool & pool, std::atomic<long> & nRun, int depth) {
+    ++nRun;
+    if (depth == 0)
+        return;
+    for (int k = 0; k < 2; ++k)
+        pool.push([&pool, &nRun, depth](int) { fan_out(pool, nRun, depth - 1); });
+}
+
+static void test_spill() {
+    for (int k = 0; k < 10; ++k) {
+        ctpl::thread_pool pool(8, ctpl::schedule::work_stealing);
+        std::atomic<long> nRun(0);
+        pool.push([&pool, &nRun](int) { fan_out(pool, nRun, 14); });
+        while (nRun < 1000)
+            std::this_thread::yield();
+        pool.resize(1);  // the removed threads spill their deques to the queue
+        bool isIdle = pool.wait_idle(std::chrono::seconds(10));
+        if (k == 0 || !isIdle || nRun != (1 << 15) - 1) {
+            check(isIdle, "deques spilled on resize(): idle");
+            check(nRun == (1 << 15) - 1, "deques spilled on resize(): every functor run");
+        }
+        pool.resize(4);
+        pool.push([&pool, &nRun](int) { fan_out(pool, nRun, 10); });
+        pool.resize(0);
+        pool.resize(2);
+        isIdle = pool.wait_idle(std::chrono::seconds(10));
+        if (k == 0 || !isIdle) {
+            check(isIdle, "deques spilled on resize(0): idle");
+            check_drained(pool, "deques spilled");
+        }
+    }
+}
+
+static void test_drain_timeout() {
+    ctpl::thread_pool pool(2);
+    gate g;
+    pool.push([&g](int) { g.wait(); });
+    std::thread opener([&g]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        g.open();
+    });
+    auto start = Clock::now();
+    ctpl::drain_result r = pool.drain(std::chrono::milliseconds(50));
+    check(!r.isDrained, "drain() of a busy pool: not drained in time");
+    check(Clock::now() - start < std::chrono::seconds(5), "drain() of a busy pool: returns once the running functor is finished");
+    opener.join();
+}
+
+int main() {
+#if _ctplThreadPoolCoroutines_
+    test_coroutines();
+#endif
+    test_batches();
+    test_spill();
+    test_drain_timeout();
+    std::cout << (nFailed == 0 ? "all passed" : std::to_string(nFailed) + " failed") << std::endl;
+    return nFailed == 0 ? 0 : 1;
+}
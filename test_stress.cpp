@@ -0,0 +1,261 @@
+// pushes from many threads while the pool changes under them, to be run under the address and the thread sanitizers:
+// producers torn down with their functors in flight, the pool resized and scaled during the pushes, stop(false) with
+// the timers, the batches, the inboxes, the deques and the rings of the producers all holding functors
+// every future must get its result or the broken promise error, and no functor may be left alive
+// prints one line per check and returns 1 if any of them failed
+//
+//     g++ -std=c++11 -O1 -g -pthread -fsanitize=address -I. test_stress.cpp -o test_stress_asan                   (ctpl.h, boost lockfree queue)
+//     g++ -std=c++11 -O1 -g -pthread -fsanitize=thread -I. -D_ctplTestStl_ test_stress.cpp -o test_stress_tsan    (ctpl_stl.h, mutex queue)
+//     g++ -std=c++11 -O1 -g -pthread -fsanitize=thread -I. -D_ctplTestStl_ -D_ctplThreadPoolRing_=1024 test_stress.cpp -o test_stress_ring
+//
+//     test_stress [rounds]
+//
+// the thread sanitizer is run on ctpl_stl.h, since it reports the free list of boost::lockfree::queue itself
+
+#ifdef _ctplTestStl_
+#include <ctpl_stl.h>
+#else
+#include <ctpl.h>
+#endif
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+
+
+typedef std::chrono::steady_clock Clock;
+
+static int nFailed = 0;
+
+static void check(bool isOk, const std::string & what) {
+    std::cout << (isOk ? "ok   " : "FAIL ") << what << std::endl;
+    if (!isOk)
+        ++nFailed;
+}
+
+// counts its copies alive, captured by every functor, so a functor neither run nor deleted is found
+class token {
+public:
+    token() { ++nLive; }
+    token(const token &) { ++nLive; }
+    ~token() { --nLive; }
+    static std::atomic<long> nLive;
+};
+std::atomic<long> token::nLive(0);
+
+// the functors stay in the queue until the gate opens
+class gate {
+public:
+    gate() : opened(promise.get_future().share()) {}
+    void open() { this->promise.set_value(); }
+    void wait() const { this->opened.wait(); }
+private:
+    std::promise<void> promise;
+    std::shared_future<void> opened;
+};
+
+// how the futures ended, each must be ready in time
+struct outcome {
+    int nRun;
+    int nBroken;
+    int nHung;
+};
+
+static outcome settle(std::vector<ctpl::future<int>> & fs) {
+    outcome r = { 0, 0, 0 };
+    for (auto & f : fs) {
+        if (f.wait_for(std::chrono::seconds(20)) != std::future_status::ready) {
+            ++r.nHung;
+            continue;
+        }
+        try {
+            f.get();
+            ++r.nRun;
+        }
+        catch (std::future_error &) {
+            ++r.nBroken;
+        }
+    }
+    fs.clear();
+    return r;
+}
+
+// producers push through their handles and drop them while the threads still move the functors out of the rings,
+// another thread clears the queue meanwhile
+static void test_producers(ctpl::thread_pool & pool, const std::string & name) {
+    const int nProducers = 4, nPushes = 2000;
+    std::atomic<int> nRun(0), nPosted(0);
+    std::vector<std::vector<ctpl::future<int>>> fs(nProducers);
+    std::atomic<bool> isPushing(true);
+    std::thread clearer([&pool, &isPushing]() {
+        while (isPushing) {
+            pool.clear_queue();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    std::vector<std::thread> producers;
+    for (int p = 0; p < nProducers; ++p) {
+        producers.emplace_back([&pool, &fs, &nRun, &nPosted, p, nPushes]() {
+            token t;
+            for (int round = 0; round < 4; ++round) {
+                auto h = pool.make_producer(64);
+                for (int k = 0; k < nPushes / 4; ++k) {
+                    if (k % 3 == 0) {
+                        h.post([&nRun, t](int) { ++nRun; });
+                        ++nPosted;
+                    }
+                    else
+                        fs[p].push_back(h.push([&nRun, t](int) { ++nRun; return 1; }));
+                }
+                if (round % 2 == 0)
+                    h.reset();  // the functors still in the ring go to the queue
+                // else the handle is destroyed at the end of the round
+            }
+        });
+    }
+    for (auto & p : producers)
+        p.join();
+    isPushing = false;
+    clearer.join();
+    bool isIdle = pool.wait_idle(std::chrono::seconds(20));
+    outcome r = { 0, 0, 0 };
+    for (auto & f : fs) {
+        outcome k = settle(f);
+        r.nRun += k.nRun; r.nBroken += k.nBroken; r.nHung += k.nHung;
+    }
+    check(isIdle, name + ": producers torn down in flight, idle");
+    check(r.nHung == 0, name + ": producers torn down in flight, every future ready");
+    check(nRun >= r.nRun && nRun <= r.nRun + nPosted, name + ": producers torn down in flight, the functors run once");
+}
+
+// threads push by every way while the pool is resized by another thread and scaled by the pool itself
+static void test_scaling(ctpl::thread_pool & pool, const std::string & name) {
+    pool.set_autoscale(ctpl::autoscale(1, 8, std::chrono::milliseconds(2), 0, std::chrono::milliseconds(1)));
+    std::atomic<bool> isPushing(true);
+    std::thread resizer([&pool, &isPushing]() {
+        for (int k = 0; isPushing; ++k) {
+            pool.resize(1 + k % 6);
+            std::this_thread::sleep_for(std::chrono::microseconds(300));
+        }
+    });
+    std::atomic<int> nRun(0);
+    std::vector<std::vector<ctpl::future<int>>> fs(4);
+    std::vector<std::thread> pushers;
+    for (int p = 0; p < 4; ++p) {
+        pushers.emplace_back([&pool, &fs, &nRun, p]() {
+            token t;
+            auto h = pool.make_producer(32);
+            for (int k = 0; k < 1500; ++k) {
+                auto f = [&pool, &nRun, t, k](int) {
+                    ++nRun;
+                    if (k % 50 == 0)  // to the deque of the thread when work stealing
+                        pool.push([&nRun, t](int) { ++nRun; return 1; }).get();
+                    return 1;
+                };
+                switch (k % 4) {
+                case 0: fs[p].push_back(pool.push(f)); break;
+                case 1: fs[p].push_back(h.push(f)); break;
+                case 2: fs[p].push_back(pool.push(k % 8 == 2 ? ctpl::priority::high : ctpl::priority::low, f)); break;
+                default:
+                    try {
+                        fs[p].push_back(pool.push_to(ctpl::affinity::preferred, k % 3, f));
+                    }
+                    catch (std::out_of_range &) {  // the pool is smaller now
+                        fs[p].push_back(pool.push(f));
+                    }
+                }
+            }
+        });
+    }
+    for (auto & p : pushers)
+        p.join();
+    isPushing = false;
+    resizer.join();
+    bool isIdle = pool.wait_idle(std::chrono::seconds(20));
+    outcome r = { 0, 0, 0 };
+    for (auto & f : fs) {
+        outcome k = settle(f);
+        r.nRun += k.nRun; r.nBroken += k.nBroken; r.nHung += k.nHung;
+    }
+    pool.set_autoscale(ctpl::autoscale());
+    check(isIdle, name + ": resized and scaled while pushing, idle");
+    check(r.nHung == 0 && r.nBroken == 0 && r.nRun == 6000, name + ": resized and scaled while pushing, every functor run");
+}
+
+// stop(false) while all the threads run a functor that waits at the gate, with functors in their batches, inboxes and deques,
+// in the rings of the producers and in the timers
+static void test_stop(ctpl::schedule mode, const std::string & name) {
+    std::vector<ctpl::future<int>> fs;
+    std::vector<ctpl::timer> timers;
+    std::atomic<int> nRun(0);
+    int nDeleted = 0;
+    {
+        ctpl::thread_pool pool(4, mode);
+        pool.set_batch(8);
+        token t;
+        gate g;
+        std::atomic<int> nWaiting(0);
+        for (int k = 0; k < 64; ++k) {  // more than the batches of the 4 threads, so each of them runs one
+            fs.push_back(pool.push([&pool, &g, &nWaiting, &nRun, t](int) {
+                std::vector<ctpl::future<int>> mine;  // to the deque when work stealing
+                for (int j = 0; j < 16; ++j)
+                    mine.push_back(pool.push([&nRun, t](int) { ++nRun; return 1; }));
+                ++nWaiting;
+                g.wait();
+                (void)mine;  // broken by stop(false) if not run
+                return 1;
+            }));
+        }
+        for (int k = 0; k < 200; ++k)
+            fs.push_back(pool.push([&nRun, t](int) { ++nRun; return 1; }));
+        while (nWaiting < 4)
+            std::this_thread::yield();
+        for (int k = 0; k < 40; ++k)
+            fs.push_back(pool.push_to(k % 4, [&nRun, t](int) { ++nRun; return 1; }));
+        for (int k = 0; k < 10; ++k) {
+            fs.push_back(pool.push_after(std::chrono::hours(1), [&nRun, t](int) { ++nRun; return 1; }));
+            timers.push_back(pool.post_every(std::chrono::hours(1), [&nRun, t](int) { ++nRun; }));
+        }
+        std::vector<ctpl::thread_pool::producer> handles;
+        for (int p = 0; p < 3; ++p) {
+            handles.push_back(pool.make_producer(64));
+            for (int k = 0; k < 50; ++k)
+                fs.push_back(handles.back().push([&nRun, t](int) { ++nRun; return 1; }));
+        }
+        std::thread opener([&g]() {  // stop() waits for the running functors
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            g.open();
+        });
+        nDeleted = pool.drain(std::chrono::milliseconds(0)).nAbandoned;
+        opener.join();
+        handles.clear();  // after the stop, before the pool is gone
+    }
+    outcome r = settle(fs);
+    check(r.nHung == 0, name + ": stopped with everything queued, every future ready");
+    check(r.nBroken > 0 && nDeleted >= r.nBroken, name + ": stopped with everything queued, the queued functors deleted");
+    check(token::nLive == 0, name + ": stopped with everything queued, no functor left alive");
+    timers.clear();
+}
+
+int main(int argc, char ** argv) {
+    int nRounds = argc > 1 ? std::atoi(argv[1]) : 3;
+    for (int round = 0; round < nRounds; ++round) {
+        {
+            ctpl::thread_pool pool(4);
+            test_producers(pool, "fifo");
+            pool.set_batch(4);
+            test_scaling(pool, "fifo");
+        }
+        {
+            ctpl::thread_pool pool(4, ctpl::schedule::work_stealing);
+            test_producers(pool, "work stealing");
+            test_scaling(pool, "work stealing");
+        }
+        check(token::nLive == 0, "no functor left alive");
+        test_stop(ctpl::schedule::fifo, "fifo");
+        test_stop(ctpl::schedule::work_stealing, "work stealing");
+    }
+    std::cout << (nFailed == 0 ? "all passed" : std::to_string(nFailed) + " failed") << std::endl;
+    return nFailed == 0 ? 0 : 1;
+}